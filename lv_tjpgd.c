@@ -41,6 +41,13 @@ static lv_res_t decoder_read(lv_img_decoder_t * decoder,
                          lv_coord_t x, lv_coord_t y,
                          lv_coord_t len, uint8_t *buf);
 static void decoder_close(lv_img_decoder_t * dec, lv_img_decoder_dsc_t * dsc);
+static uint8_t bits_on_pixel(uint8_t format);
+static uint8_t native_format(void);
+static void mjpeg_task(lv_task_t * task);
+static void * mem_alloc(size_t size);
+static void mem_free(void * p);
+static bool alloc_buffers(void);
+static void * grow_buffer(void ** buf, uint32_t * buf_size, uint32_t size);
 
 /**********************
  *  STATIC VARIABLES
@@ -57,16 +64,33 @@ static void decoder_close(lv_img_decoder_t * dec, lv_img_decoder_dsc_t * dsc);
  /* User defined device identifier */
 typedef struct {
     FILE *fp;                       /* File pointer for input function */
+    uint8_t *image_data;            /* Pointer to the decoded image (palette and frame buffer) */
     uint8_t *frame_buffer;          /* Pointer to the frame buffer for output function */
     uint16_t frame_buffer_width;    /* Width of the frame buffer [pix] */
+    uint16_t frame_buffer_height;   /* Height of the frame buffer [pix] */
+    uint8_t bits_on_pixel;          /* Size of a pixel in the frame buffer [bits] */
 } IODEV;
 
 // See: JD_SZBUF		512	/* Size of stream input buffer */
 #define TJPGD_WORK_BUFFER_SIZE  (20*1024)
 
-/* Work buffer */
+/* Work buffer, allocated at the first decode and reused by the next ones
+ * (each jd_prepare starts over at the beginning of it) */
 void *work = NULL;
 
+/* Quantizer and huffman tables shared by the decoded images, NULL when not caching */
+static JDCACHE tbl_cache;
+static JDCACHE *cache = NULL;
+static void *cache_mem = NULL;
+
+/* Coefficient buffer of progressive JPGs kept over the decodes, only grown when needed */
+static void *coef_buf = NULL;
+static uint32_t coef_buf_size = 0;
+
+/* Allocator of the buffers, lv_mem_alloc and lv_mem_free when not set */
+static lv_tjpgd_alloc_cb_t mem_alloc_cb = NULL;
+static lv_tjpgd_free_cb_t mem_free_cb = NULL;
+
 /* Decoding session */
 JDEC jdec;
 
@@ -84,6 +108,44 @@ typedef struct {
     img_size size;
 } decoder_ctx;
 
+/* Motion-JPEG player */
+struct _lv_tjpgd_mjpeg_t {
+    JDEC jdec;              /* Decoding session kept over the frames */
+    IODEV dev;              /* Input file and frame buffer to decode into */
+    void *work;             /* Work buffer of the session */
+    void *coef;             /* Coefficient buffer of progressive frames */
+    uint32_t coef_size;     /* Size of the coefficient buffer [bytes] */
+    lv_obj_t *canvas;       /* Canvas showing the frames */
+    uint8_t *buf[2];        /* Frame buffers, one shown and the other decoded into */
+    uint8_t back;           /* Index of the frame buffer the next frame is decoded into */
+    uint8_t orient;         /* EXIF orientation the frames are decoded in (taken from the first frame) */
+    uint8_t rotate;         /* Display rotation the frames are decoded in */
+    bool prepared;          /* The next frame has been prepared */
+    lv_task_t *task;        /* Task decoding the frames at the frame rate */
+};
+
+/* Scaling factor and output pixel format of the next decodes */
+static uint8_t out_scale = LV_TJPGD_SCALING_FACTOR;
+static uint8_t out_format = LV_TJPGD_FORMAT;
+static bool out_dither = false;
+static bool out_fancy = false;
+
+/* Decode the EXIF thumbnail instead of the main image when it is big enough */
+static bool out_thumb = true;
+
+/* Decode the images in the orientation of their EXIF Orientation tag */
+static bool out_orient = true;
+
+/* Rotation of the display panel the images are decoded for (0: none, 1: 90, 2: 180, 3: 270 degrees) */
+static uint8_t out_rotate = 0;
+
+/* The image of the current session is the EXIF thumbnail */
+static bool dec_thumb = false;
+
+/* Box the decoded images have to fit in, 0 when not fitting */
+static lv_coord_t fit_w = 0;
+static lv_coord_t fit_h = 0;
+
 /* NOTE: Keep track on the amount of times the decoder calls the output callbacks */
 volatile uint32_t out_func_calls = 0;
 
@@ -98,7 +160,7 @@ volatile uint32_t out_func_calls = 0;
  *
  * @retval number of bytes successfully read
  */
-static uint16_t on_feed_decoder_cb(JDEC* jd, uint8_t* buff, uint16_t nbyte);
+static jd_size_t on_feed_decoder_cb(JDEC* jd, uint8_t* buff, jd_size_t nbyte);
 
 /* Decoder output callback.
  *
@@ -115,8 +177,7 @@ static uint16_t on_decoder_output_cb(JDEC* jd, void* bitmap, JRECT* rect);
  */
 void lv_tjpgd_init(void)
 {
-    /* Allocate work area for tjpgd */
-    work = malloc(TJPGD_WORK_BUFFER_SIZE);
+    /* The work area of tjpgd is allocated at the first decode */
 
     lv_img_decoder_t * dec = lv_img_decoder_create();
 
@@ -135,10 +196,507 @@ void lv_tjpgd_init(void)
     lv_img_decoder_set_close_cb(dec, decoder_close);
 }
 
+/**
+ * Set the scaling factor of the images decoded from now on
+ *
+ * @param scale 0: none, 1: 1/2, 2: 1/4, 3: 1/8
+ */
+void lv_tjpgd_set_scale(uint8_t scale)
+{
+    if (scale <= 3) {
+        out_scale = scale;
+    }
+}
+
+/**
+ * Set the output pixel format of the images decoded from now on
+ *
+ * @param format JD_FMT_*
+ */
+void lv_tjpgd_set_format(uint8_t format)
+{
+    if (format <= JD_FMT_MONO1) {
+        out_format = format;
+    }
+}
+
+/**
+ * Enable ordered dithering of the RGB565 images decoded from now on
+ *
+ * @param en true: dither, false: truncate
+ */
+void lv_tjpgd_set_dither(bool en)
+{
+    out_dither = en;
+}
+
+/**
+ * Enable smooth chroma upsampling of the images decoded from now on
+ *
+ * @param en true: triangle filter, false: pixel replication
+ */
+void lv_tjpgd_set_fancy_upsampling(bool en)
+{
+    out_fancy = en;
+}
+
+/**
+ * Set the box the decoded images have to fit in
+ *
+ * @param w width of the box, 0 to disable fitting
+ * @param h height of the box, 0 to disable fitting
+ */
+void lv_tjpgd_set_fit_size(lv_coord_t w, lv_coord_t h)
+{
+    fit_w = w;
+    fit_h = h;
+}
+
+/**
+ * Enable decoding the EXIF thumbnail of the images decoded from now on
+ * when it is big enough for the decoded image size
+ *
+ * @param en true: use the thumbnail when possible, false: always decode the main image
+ */
+void lv_tjpgd_set_thumbnail(bool en)
+{
+    out_thumb = en;
+}
+
+/**
+ * Enable decoding the images decoded from now on in the orientation of
+ * their EXIF Orientation tag
+ *
+ * @param en true: rotate and mirror as tagged, false: decode as stored
+ */
+void lv_tjpgd_set_exif_orientation(bool en)
+{
+    out_orient = en;
+}
+
+/**
+ * Set the rotation of the display panel the images decoded from now on are shown on
+ *
+ * @param rot 0: none, 1: 90, 2: 180, 3: 270 degrees clockwise
+ */
+void lv_tjpgd_set_rotation(uint8_t rot)
+{
+    if (rot <= 3) {
+        out_rotate = rot;
+    }
+}
+
+/**
+ * Open a Motion-JPEG stream (JPG frames one after another, e.g. a .mjpeg file)
+ * to be played on a canvas. The decoding session, its tables and buffers are
+ * kept over the frames, frames without DHT segment use the standard tables.
+ * The EXIF orientation of the first frame and the display rotation set at
+ * opening apply to all the frames.
+ *
+ * @param fn file name of the stream
+ * @param canvas canvas to show the frames on, its buffer is set to the frame buffers
+ * @param period time between the frames [ms], 0 to decode the frames with lv_tjpgd_mjpeg_next_frame only
+ * @return pointer to the player, NULL on error
+ */
+lv_tjpgd_mjpeg_t * lv_tjpgd_mjpeg_open(const char * fn, lv_obj_t * canvas, uint32_t period)
+{
+    if (native_format() == 0xFF) {
+        return NULL;
+    }
+
+    lv_tjpgd_mjpeg_t * mj = (lv_tjpgd_mjpeg_t *) mem_alloc(sizeof(lv_tjpgd_mjpeg_t));
+    if (!mj) {
+        return NULL;
+    }
+    memset(mj, 0, sizeof(lv_tjpgd_mjpeg_t));
+
+    mj->canvas = canvas;
+    mj->dev.fp = fopen(fn, "rb");
+    mj->work = mem_alloc(TJPGD_WORK_BUFFER_SIZE);
+
+    /* The first frame gives the size of the canvas */
+    if (mj->dev.fp && mj->work
+        && JDR_OK == jd_prepare(&mj->jdec, on_feed_decoder_cb, mj->work, TJPGD_WORK_BUFFER_SIZE, &mj->dev)) {
+        uint32_t frame_size = (uint32_t) mj->jdec.width * mj->jdec.height * sizeof(lv_color_t);
+
+        /* Rotating by 90 or 270 degrees swaps the width and height of the canvas */
+        mj->orient = out_orient ? mj->jdec.orient : 1;
+        mj->rotate = out_rotate;
+        if ((mj->orient >= 5) != ((mj->rotate & 1) != 0)) {
+            mj->dev.frame_buffer_width = mj->jdec.height;
+            mj->dev.frame_buffer_height = mj->jdec.width;
+        } else {
+            mj->dev.frame_buffer_width = mj->jdec.width;
+            mj->dev.frame_buffer_height = mj->jdec.height;
+        }
+        mj->dev.bits_on_pixel = bits_on_pixel(native_format());
+        mj->buf[0] = (uint8_t *) mem_alloc(frame_size);
+        mj->buf[1] = (uint8_t *) mem_alloc(frame_size);
+        mj->prepared = true;
+
+        if (mj->buf[0] && mj->buf[1]) {
+            if (period) {
+                mj->task = lv_task_create(mjpeg_task, period, LV_TASK_PRIO_MID, mj);
+            }
+            if (!period || mj->task) {
+                return mj;
+            }
+        }
+    }
+
+    lv_tjpgd_mjpeg_close(mj);
+
+    return NULL;
+}
+
+/**
+ * Decode the next frame of a Motion-JPEG stream into the back buffer and
+ * show it on the canvas. The stream starts over at its end.
+ *
+ * @param mj pointer to the player
+ * @return LV_RES_OK: the frame is shown; LV_RES_INV: the frame is skipped (error or other size)
+ */
+lv_res_t lv_tjpgd_mjpeg_next_frame(lv_tjpgd_mjpeg_t * mj)
+{
+    JRESULT res = JDR_OK;
+
+    if (!mj->prepared) {
+        res = jd_prepare_frame(&mj->jdec);
+        if (JDR_INP == res) {
+            /* End of the stream, start it over */
+            rewind(mj->dev.fp);
+            res = jd_prepare(&mj->jdec, on_feed_decoder_cb, mj->work, TJPGD_WORK_BUFFER_SIZE, &mj->dev);
+        }
+    }
+    mj->prepared = false;
+
+    bool swap = (mj->orient >= 5) != ((mj->rotate & 1) != 0);
+
+    if (JDR_OK != res
+        || (swap ? mj->jdec.height : mj->jdec.width) != mj->dev.frame_buffer_width
+        || (swap ? mj->jdec.width : mj->jdec.height) != mj->dev.frame_buffer_height) {
+        return LV_RES_INV;
+    }
+
+    /* Decode the frame into the buffer not shown */
+    mj->jdec.format = native_format();
+    mj->jdec.orient = mj->orient;
+    mj->jdec.rotate = mj->rotate;
+    mj->jdec.dither = out_dither ? 1 : 0;
+    mj->jdec.fancy = out_fancy ? 1 : 0;
+    if (mj->jdec.progressive) {
+        mj->jdec.coef = (int16_t *) grow_buffer(&mj->coef, &mj->coef_size, mj->jdec.sz_coef);
+        if (!mj->jdec.coef) {
+            return LV_RES_INV;
+        }
+    }
+    mj->dev.frame_buffer = mj->buf[mj->back];
+    mj->jdec.obuf = mj->dev.frame_buffer;
+    mj->jdec.ostride = (uint32_t) mj->dev.frame_buffer_width * sizeof(lv_color_t);
+    mj->jdec.batch = 0xFFFF;
+    if (mj->jdec.fancy) {
+        JDMEMREQ req;
+        if (JDR_OK != jd_memreq(&mj->jdec, 0, 0, 0, &req) || req.pool > TJPGD_WORK_BUFFER_SIZE) {
+            mj->jdec.fancy = 0;     /* Pixel replication if the MCU row of the triangle filter does not fit */
+        }
+    }
+
+    res = jd_decomp(&mj->jdec, on_decoder_output_cb, 0);
+
+    mj->jdec.coef = NULL;
+
+    if (JDR_OK != res) {
+        return LV_RES_INV;
+    }
+
+    /* Show the frame and decode the next one into the other buffer */
+    lv_canvas_set_buffer(mj->canvas, mj->buf[mj->back],
+                         (lv_coord_t) mj->dev.frame_buffer_width, (lv_coord_t) mj->dev.frame_buffer_height,
+                         LV_IMG_CF_TRUE_COLOR);
+    mj->back ^= 1;
+
+    return LV_RES_OK;
+}
+
+/**
+ * Stop playing a Motion-JPEG stream and free the resources of the player.
+ * The canvas keeps pointing to a freed frame buffer, set another buffer or
+ * delete it.
+ *
+ * @param mj pointer to the player
+ */
+void lv_tjpgd_mjpeg_close(lv_tjpgd_mjpeg_t * mj)
+{
+    if (mj->task) {
+        lv_task_del(mj->task);
+    }
+    if (mj->dev.fp) {
+        fclose(mj->dev.fp);
+    }
+    mem_free(mj->buf[0]);
+    mem_free(mj->buf[1]);
+    mem_free(mj->coef);
+    mem_free(mj->work);
+    mem_free(mj);
+}
+
+/**
+ * Set the functions the buffers of the decoder are allocated and freed with.
+ * Set them before decoding any image, the buffers kept over the decodes are
+ * released and allocated again with the new functions.
+ *
+ * @param alloc_cb function allocating a buffer, NULL to use lv_mem_alloc (default)
+ * @param free_cb function freeing a buffer, NULL to use lv_mem_free (default)
+ */
+void lv_tjpgd_set_allocator(lv_tjpgd_alloc_cb_t alloc_cb, lv_tjpgd_free_cb_t free_cb)
+{
+    lv_tjpgd_release_buffers();
+
+    mem_alloc_cb = alloc_cb;
+    mem_free_cb = free_cb;
+}
+
+/**
+ * Release the buffers kept over the decodes: the work buffer, the table cache
+ * and the coefficient buffer. The next decode allocates them again.
+ */
+void lv_tjpgd_release_buffers(void)
+{
+    mem_free(work);
+    work = NULL;
+
+    mem_free(cache_mem);
+    cache_mem = NULL;
+    cache = NULL;
+
+    mem_free(coef_buf);
+    coef_buf = NULL;
+    coef_buf_size = 0;
+}
+
 /**********************
  *   STATIC FUNCTIONS
  **********************/
 
+/**
+ * Allocate a buffer with the allocator set by lv_tjpgd_set_allocator
+ *
+ * @param size size of the buffer [bytes]
+ * @return pointer to the buffer, NULL when out of memory
+ */
+static void * mem_alloc(size_t size)
+{
+    return mem_alloc_cb ? mem_alloc_cb(size) : lv_mem_alloc(size);
+}
+
+/**
+ * Free a buffer allocated by mem_alloc
+ *
+ * @param p pointer to the buffer, NULL is ignored
+ */
+static void mem_free(void * p)
+{
+    if (!p) {
+        return;
+    }
+
+    if (mem_free_cb) {
+        mem_free_cb(p);
+    } else {
+        lv_mem_free(p);
+    }
+}
+
+/**
+ * Allocate the buffers kept over the decodes if they are not allocated yet
+ *
+ * @return true: the work buffer is available (the table cache is optional)
+ */
+static bool alloc_buffers(void)
+{
+    if (!work) {
+        work = mem_alloc(TJPGD_WORK_BUFFER_SIZE);
+    }
+
+#if LV_TJPGD_TABLE_CACHE_SIZE > 0
+    if (!cache_mem) {
+        cache_mem = mem_alloc(LV_TJPGD_TABLE_CACHE_SIZE);
+        if (cache_mem) {
+            jd_cache_init(&tbl_cache, cache_mem, LV_TJPGD_TABLE_CACHE_SIZE);
+            cache = &tbl_cache;
+        }
+    }
+#endif
+
+    return work != NULL;
+}
+
+/**
+ * Get a buffer kept over the decodes, it is only reallocated when it is too small
+ *
+ * @param buf pointer to the buffer, updated when reallocated
+ * @param buf_size size of the buffer [bytes], updated when reallocated
+ * @param size size needed [bytes]
+ * @return pointer to the buffer, NULL when out of memory
+ */
+static void * grow_buffer(void ** buf, uint32_t * buf_size, uint32_t size)
+{
+    if (size > *buf_size) {
+        mem_free(*buf);
+        *buf = mem_alloc(size);
+        *buf_size = *buf ? size : 0;
+    }
+
+    return *buf;
+}
+
+/**
+ * Get the output pixel format drawn directly on the display
+ *
+ * @return JD_FMT_*, 0xFF when no format matches the display colors
+ */
+static uint8_t native_format(void)
+{
+#if LV_COLOR_DEPTH == 32
+    return JD_FMT_ARGB8888;
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP == 0
+    return JD_FMT_RGB565;
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP != 0
+    return JD_FMT_RGB565_SWAP;
+#else
+    return 0xFF;
+#endif
+}
+
+/**
+ * Decode a frame of a Motion-JPEG player at the frame rate
+ *
+ * @param task task of the player
+ */
+static void mjpeg_task(lv_task_t * task)
+{
+    lv_tjpgd_mjpeg_next_frame((lv_tjpgd_mjpeg_t *) task->user_data);
+}
+
+/**
+ * Get the size of a pixel in an output pixel format
+ *
+ * @param format JD_FMT_*
+ * @return size of a pixel in bits
+ */
+static uint8_t bits_on_pixel(uint8_t format)
+{
+    switch (format) {
+    case JD_FMT_MONO1:
+        return 1;
+    case JD_FMT_GRAY4:
+        return 4;
+    case JD_FMT_GRAY8:
+        return 8;
+    case JD_FMT_RGB565:
+    case JD_FMT_RGB565_SWAP:
+        return 16;
+    case JD_FMT_ARGB8888:
+        return 32;
+    default:
+        return 24;
+    }
+}
+
+/**
+ * Get the number of palette entries in front of the decoded image.
+ * Grayscale formats are drawn by LVGL as indexed images with a gray ramp palette.
+ *
+ * @param format JD_FMT_*
+ * @return number of palette entries, 0 for formats without palette
+ */
+static uint16_t palette_entries(uint8_t format)
+{
+    switch (format) {
+    case JD_FMT_MONO1:
+    case JD_FMT_GRAY4:
+    case JD_FMT_GRAY8:
+        return 1 << bits_on_pixel(format);
+    default:
+        return 0;
+    }
+}
+
+/**
+ * Get the LVGL color format of an output pixel format.
+ * Formats matching the display colors and grayscale formats are drawn
+ * directly, the others are reported as raw data.
+ *
+ * @param format JD_FMT_*
+ * @return LVGL color format
+ */
+static lv_img_cf_t color_format(uint8_t format)
+{
+    switch (format) {
+    case JD_FMT_MONO1:
+        return LV_IMG_CF_INDEXED_1BIT;
+    case JD_FMT_GRAY4:
+        return LV_IMG_CF_INDEXED_4BIT;
+    case JD_FMT_GRAY8:
+        return LV_IMG_CF_INDEXED_8BIT;
+    default:
+        break;
+    }
+
+#if LV_COLOR_DEPTH == 32
+    if (format == JD_FMT_ARGB8888) {
+        return LV_IMG_CF_TRUE_COLOR;
+    }
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP == 0
+    if (format == JD_FMT_RGB565) {
+        return LV_IMG_CF_TRUE_COLOR;
+    }
+#elif LV_COLOR_DEPTH == 16 && LV_COLOR_16_SWAP != 0
+    if (format == JD_FMT_RGB565_SWAP) {
+        return LV_IMG_CF_TRUE_COLOR;
+    }
+#endif
+
+    return LV_IMG_CF_RAW;
+}
+
+/**
+ * Prepare the EXIF thumbnail instead of the prepared main image when it is
+ * big enough for the decoded image size and has the same aspect ratio.
+ * The main image is left prepared otherwise.
+ *
+ * @param w width of the decoded image before orienting
+ * @param h height of the decoded image before orienting
+ * @return JDR_OK: no error (`dec_thumb` tells which image is prepared), error code of jd_prepare otherwise
+ */
+static JRESULT prepare_thumbnail(uint16_t w, uint16_t h)
+{
+    uint32_t iw = jdec.width;
+    uint32_t ih = jdec.height;
+
+    dec_thumb = false;
+    if (!out_thumb || !jdec.thumb_len || (w >= iw && h >= ih)) {
+        return JDR_OK;
+    }
+
+    rewind(devid.fp);
+    if (JDR_OK == jd_prepare_thumb(&jdec, on_feed_decoder_cb, work, TJPGD_WORK_BUFFER_SIZE, &devid)) {
+        uint32_t tw = jdec.width;
+        uint32_t th = jdec.height;
+        uint32_t d = (tw * ih > th * iw) ? tw * ih - th * iw : th * iw - tw * ih;
+
+        /* Only reduce the thumbnail, and skip thumbnails letterboxed to another aspect ratio */
+        if (tw >= w && th >= h && d <= tw * ih / 32) {
+            dec_thumb = true;
+            return JDR_OK;
+        }
+    }
+
+    /* Prepare the main image again */
+    rewind(devid.fp);
+    return jd_prepare_cached(&jdec, on_feed_decoder_cb, work, TJPGD_WORK_BUFFER_SIZE, &devid, cache);
+}
+
 /**
  * Get information about a JPG image
  *
@@ -158,42 +716,133 @@ static lv_res_t decoder_info(struct _lv_img_decoder * decoder, const void * src,
          /*Check the extension*/
          if(!strcmp(&fn[strlen(fn) - 3], VALID_FILE_EXTENSION)) {
 
+             /* The file of an image not opened after getting its info is still open */
+             if (devid.fp) {
+                fclose(devid.fp);
+             }
              devid.fp = fopen(fn, "rb");
-             if(!devid.fp) {
+             if(!devid.fp || !alloc_buffers()) {
                 return LV_RES_INV;
              }
 
              /* Prepare for decompress and get the image information */
-             JRESULT res = jd_prepare(&jdec, on_feed_decoder_cb, work, TJPGD_WORK_BUFFER_SIZE, &devid);
+             JRESULT res = jd_prepare_cached(&jdec, on_feed_decoder_cb, work, TJPGD_WORK_BUFFER_SIZE, &devid, cache);
+             uint8_t orient = 1;
 
             if (JDR_OK == res) {
-                header->always_zero = 0;
-                /* Color format */
-                header->cf = LV_IMG_CF_RAW; // LV_IMG_CF_RAW
+                /* Orientation of the decoded image, rotating by 90 or 270 degrees
+                 * swaps its width and height */
+                uint16_t iw = jdec.width;
+                uint16_t ih = jdec.height;
+
+                if (out_orient) {
+                    orient = jdec.orient;
+                }
+                if (orient >= 5) {
+                    iw = jdec.height;
+                    ih = jdec.width;
+                }
+
+                if (fit_w > 0 && fit_h > 0) {
+                    /* Image size:
+                     * Reduce the image to the biggest size fitting in the box
+                     * while keeping its aspect ratio, jd_decomp_sized does the rest. */
+                    uint32_t w = iw;
+                    uint32_t h = ih;
+
+                    if (w > (uint32_t) fit_w || h > (uint32_t) fit_h) {
+                        if (w * fit_h > h * fit_w) {
+                            h = (h * fit_w + w / 2) / w;
+                            w = fit_w;
+                        } else {
+                            w = (w * fit_h + h / 2) / h;
+                            h = fit_h;
+                        }
+                        if (!w) w = 1;
+                        if (!h) h = 1;
+                    }
+
+                    devid.frame_buffer_width = (uint16_t) w;
+                    devid.frame_buffer_height = (uint16_t) h;
+                } else {
+                    /* Image size:
+                     * When letting LVGL know what's the size of the image we also need
+                     * to consider the scaling factor.
+                     * If the image is 200 * 200 px, when setting an scaling factor
+                     * 1:2 then the image ends up being 100 * 100px.
+                     * That is why we shift the information got from jd_prepare by
+                     * the scaling factor. */
+                    devid.frame_buffer_width = iw >> out_scale;
+                    devid.frame_buffer_height = ih >> out_scale;
+                }
 
                 /* Image size:
-                 * When letting LVGL know what's the size of the image we also need
-                 * to consider the scaling factor.
-                 * If the image is 200 * 200 px, when setting an scaling factor
-                 * 1:2 then the image ends up being 100 * 100px.
-                 * That is why we divide the information got from jd_prepare by
-                 * a divisor depending on the scaling factor.
-                 *
-                 * See lv_tjpgd.h */
-                header->w = (lv_coord_t) jdec.width / LV_TJPGD_SCALING_FACTOR_DIV;
-                header->h = (lv_coord_t) jdec.height / LV_TJPGD_SCALING_FACTOR_DIV;
-
-                devid.frame_buffer_width = jdec.width / LV_TJPGD_SCALING_FACTOR_DIV;
-
-                /* NOTE: Allocate memory for the whole decoded image. Should we allocate it on the open callack?
-                 * FIXME: Assume we have successfully allocated memory for devid.frame_buffer buffer */
-                uint32_t decoded_image_buffer_size = header->w * header->h * BYTES_ON_PIXEL;
-                devid.frame_buffer = (uint8_t *) malloc(decoded_image_buffer_size);
-
-                if (!devid.frame_buffer) {
+                 * The image is written rotated into the native orientation of the panel */
+                if (out_rotate & 1) {
+                    uint16_t w = devid.frame_buffer_width;
+
+                    devid.frame_buffer_width = devid.frame_buffer_height;
+                    devid.frame_buffer_height = w;
+                }
+
+                /* Small decoded images can be reduced from the EXIF thumbnail
+                 * at a fraction of the cost of decoding the main image */
+                if ((orient >= 5) != ((out_rotate & 1) != 0)) {
+                    res = prepare_thumbnail(devid.frame_buffer_height, devid.frame_buffer_width);
+                } else {
+                    res = prepare_thumbnail(devid.frame_buffer_width, devid.frame_buffer_height);
+                }
+            }
+
+            /* Progressive JPG is decoded into a coefficient buffer of the whole image */
+            if (JDR_OK == res && jdec.progressive && jdec.sz_coef > LV_TJPGD_PROGRESSIVE_MAX_SIZE) {
+                res = JDR_MEM1;
+            }
+
+            if (JDR_OK == res) {
+                header->always_zero = 0;
+                /* Color format */
+                header->cf = color_format(out_format);
+
+                /* Output pixel format and orientation */
+                jdec.format = out_format;
+                jdec.orient = orient;
+                jdec.rotate = out_rotate;
+                jdec.dither = out_dither ? 1 : 0;
+                jdec.fancy = out_fancy ? 1 : 0;
+                devid.bits_on_pixel = bits_on_pixel(out_format);
+
+                /* The decoder writes the pixels into the frame buffer (lines of the formats
+                 * smaller than a byte start at byte boundary) and tells each MCU row done,
+                 * it costs no work buffer. Images the work buffer is too small for are
+                 * rejected here instead of failing in the middle of decoding */
+                JDMEMREQ req;
+                jdec.ostride = ((uint32_t) devid.frame_buffer_width * devid.bits_on_pixel + 7) / 8;
+                jdec.olines = 0;
+                jdec.batch = 0xFFFF;
+                for (;;) {
+                    if ((fit_w > 0 && fit_h > 0) || dec_thumb) {
+                        res = jd_memreq(&jdec, 0, devid.frame_buffer_width, devid.frame_buffer_height, &req);
+                    } else {
+                        res = jd_memreq(&jdec, out_scale, 0, 0, &req);
+                    }
+                    if (JDR_OK != res || req.pool <= TJPGD_WORK_BUFFER_SIZE || !jdec.fancy) break;
+                    /* The triangle filter keeps an MCU row of decoded blocks,
+                     * fall back to pixel replication if it does not fit */
+                    jdec.fancy = 0;
+                }
+                if (JDR_OK != res) {
+                    printf("Error ID: %d", (int) res);
+                    return LV_RES_INV;
+                }
+                if (req.pool > TJPGD_WORK_BUFFER_SIZE) {
+                    printf("Work buffer too small: %u bytes needed", (unsigned) req.pool);
                     return LV_RES_INV;
                 }
 
+                header->w = (lv_coord_t) devid.frame_buffer_width;
+                header->h = (lv_coord_t) devid.frame_buffer_height;
+
                 return LV_RES_OK;
             } else {
                 printf("Error ID: %d", (int) res);
@@ -242,13 +891,56 @@ static lv_res_t decoder_open(lv_img_decoder_t * decoder, lv_img_decoder_dsc_t *
              * we should decode the image in chunks. When decoding the image in chunks
              * we most surely will need to set dsc->img_data to NULL, then the LVGL image
              * decoder will call the read callback. */
-            error = jd_decomp(&jdec, on_decoder_output_cb, LV_TJPGD_SCALING_FACTOR);
+            /* Allocate memory for the whole decoded image,
+             * lines of the formats smaller than a byte start at byte boundary. */
+            uint16_t palette_size = palette_entries(jdec.format) * 4;
+            uint32_t line_size = ((uint32_t) devid.frame_buffer_width * devid.bits_on_pixel + 7) / 8;
+            uint32_t decoded_image_buffer_size = palette_size + line_size * devid.frame_buffer_height;
+            devid.image_data = (uint8_t *) mem_alloc(decoded_image_buffer_size);
+
+            if (!devid.image_data) {
+                return LV_RES_INV;
+            }
+
+            /* Gray ramp palette in lv_color32_t order (blue, green, red, alpha) */
+            for (uint16_t i = 0; i < palette_size / 4; i++) {
+                uint8_t v = (uint8_t) (i * 255 / (palette_size / 4 - 1));
+
+                devid.image_data[i * 4 + 0] = v;
+                devid.image_data[i * 4 + 1] = v;
+                devid.image_data[i * 4 + 2] = v;
+                devid.image_data[i * 4 + 3] = 0xFF;
+            }
+            devid.frame_buffer = devid.image_data + palette_size;
+            jdec.obuf = devid.frame_buffer;     /* Decoded straight into the frame buffer */
+            jdec.ostride = line_size;
+
+            /* The coefficient buffer of the previous progressive JPG is reused when big enough */
+            if (jdec.progressive) {
+                jdec.coef = (int16_t *) grow_buffer(&coef_buf, &coef_buf_size, jdec.sz_coef);
+                if (!jdec.coef) {
+                    mem_free(devid.image_data);
+                    return LV_RES_INV;
+                }
+            }
+
+            if ((fit_w > 0 && fit_h > 0) || dec_thumb) {
+                error = jd_decomp_sized(&jdec, on_decoder_output_cb,
+                                        devid.frame_buffer_width, devid.frame_buffer_height);
+            } else {
+                error = jd_decomp(&jdec, on_decoder_output_cb, out_scale);
+            }
+
+            jdec.coef = NULL;
+            fclose(devid.fp);
+            devid.fp = NULL;
 
             if (JDR_OK != error) {
                 printf("Error ID: %d", (int) error);
+                mem_free(devid.image_data);
                 retval = LV_RES_INV;
             } else {
-                dsc->img_data = devid.frame_buffer;
+                dsc->img_data = devid.image_data;
                 retval = LV_RES_OK;
             }
 
@@ -281,11 +973,8 @@ static void decoder_close(lv_img_decoder_t * decoder, lv_img_decoder_dsc_t * dsc
 {
     (void) decoder; /*Unused*/
 
-    free(work);
-
-    if(dsc->img_data) {
-        free((uint8_t *) dsc->img_data);
-    }
+    /* The work buffer is kept for the next image */
+    mem_free((void *) dsc->img_data);
 }
 
 /* Feed decoder callback
@@ -297,9 +986,9 @@ static void decoder_close(lv_img_decoder_t * decoder, lv_img_decoder_dsc_t * dsc
  *
  * @retval number of bytes successfully read
  */
-static uint16_t on_feed_decoder_cb(JDEC* jd, uint8_t* buff, uint16_t nbyte)
+static jd_size_t on_feed_decoder_cb(JDEC* jd, uint8_t* buff, jd_size_t nbyte)
 {
-    uint16_t retval = 0;
+    jd_size_t retval = 0;
 
     IODEV *dev = (IODEV*) jd->device;
 
@@ -314,32 +1003,19 @@ static uint16_t on_feed_decoder_cb(JDEC* jd, uint8_t* buff, uint16_t nbyte)
 
 /* Decoder output callback
  *
- * @param jd:
- * @param bitmap:
- * @param rect:
+ * @param jd: decompression object, the pixels are written into its output buffer (the frame buffer)
+ * @param bitmap: NULL, the pixels are already in the frame buffer
+ * @param rect: area of the frame buffer completed
  *
  * @retval 1 Continue to decompress, 0 to abort.
  */
 static uint16_t on_decoder_output_cb(JDEC* jd, void* bitmap, JRECT* rect)
 {
-    out_func_calls++;
-
-    /* Does bitmap means bitmap[0] = red, bitmap[1] = green, bitmap[2] = blue? */
-    IODEV *dev = (IODEV*) jd->device;
-
-    /* Copy decompressed RGB rectangular to the frame buffer */
-    uint8_t *src = (uint8_t *) bitmap;
+    (void) jd;
+    (void) bitmap;
+    (void) rect;
 
-    /* Were in the framebuffer we are writing the bitmap data */
-    uint8_t *dst = dev->frame_buffer + (BYTES_ON_PIXEL * ((rect->top * dev->frame_buffer_width) + rect->left));
-    uint16_t bws = BYTES_ON_PIXEL * (rect->right - rect->left + 1); /* Width of source rectangular */
-    uint16_t bwd = BYTES_ON_PIXEL * dev->frame_buffer_width; /* Width of frame buffer */
-
-    for (uint16_t y = rect->top; y <= rect->bottom; y++) {
-        memcpy(dst, src, bws); /* Copy a line */
-        src += bws; /* Next line */
-        dst += bwd;
-    }
+    out_func_calls++;
 
     return 1;
 }
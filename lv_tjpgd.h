@@ -14,22 +14,29 @@ extern "C" {
  *      INCLUDES
  *********************/
 
+#include "lvgl/lvgl.h"
 #include "tjpgd.h"
 
 
-/* Output configuration */
+/* Default output configuration, can be changed at runtime with lv_tjpgd_set_format */
 // #define LV_TJPGD_CONFIG_RGB888
 #define LV_TJPGD_CONFIG_RGB565
+// #define LV_TJPGD_CONFIG_RGB565_SWAP
+// #define LV_TJPGD_CONFIG_ARGB8888
 
 #if defined LV_TJPGD_CONFIG_RGB565
-    #define BYTES_ON_PIXEL 2
+    #define LV_TJPGD_FORMAT JD_FMT_RGB565
+#elif defined LV_TJPGD_CONFIG_RGB565_SWAP
+    #define LV_TJPGD_FORMAT JD_FMT_RGB565_SWAP
 #elif defined LV_TJPGD_CONFIG_RGB888
-    #define BYTES_ON_PIXEL 3
+    #define LV_TJPGD_FORMAT JD_FMT_RGB888
+#elif defined LV_TJPGD_CONFIG_ARGB8888
+    #define LV_TJPGD_FORMAT JD_FMT_ARGB8888
 #else
     #error "Invalid TJPGD output pixel format configuration"
 #endif // defined
 
-/* Scaling factor */
+/* Default scaling factor, can be changed at runtime with lv_tjpgd_set_scale */
 #define LV_TJPGD_CONFIG_SCALING_FACTOR_NONE
 //#define LV_TJPGD_CONFIG_SCALING_FACTOR_1_2
 //#define LV_TJPGD_CONFIG_SCALING_FACTOR_1_4
@@ -39,20 +46,26 @@ extern "C" {
  * set it to 1 otherwise */
 #if defined (LV_TJPGD_CONFIG_SCALING_FACTOR_NONE)
     #define LV_TJPGD_SCALING_FACTOR     0
-    #define LV_TJPGD_SCALING_FACTOR_DIV 1
 #elif defined (LV_TJPGD_CONFIG_SCALING_FACTOR_1_2)
     #define LV_TJPGD_SCALING_FACTOR     1
-    #define LV_TJPGD_SCALING_FACTOR_DIV 2
 #elif defined (LV_TJPGD_CONFIG_SCALING_FACTOR_1_4)
     #define LV_TJPGD_SCALING_FACTOR     2
-    #define LV_TJPGD_SCALING_FACTOR_DIV 4
 #elif defined (LV_TJPGD_CONFIG_SCALING_FACTOR_1_8)
     #define LV_TJPGD_SCALING_FACTOR     3
-    #define LV_TJPGD_SCALING_FACTOR_DIV 8
 #else
     #error "Invalid TJPGD scaling factor configuration"
 #endif // defined
 
+/* Biggest coefficient buffer allocated for a progressive JPG [bytes]
+ * (the whole image is held as 2 bytes per coefficient, about 3 bytes per
+ * pixel for 4:2:0 color images), bigger progressive images are rejected */
+#define LV_TJPGD_PROGRESSIVE_MAX_SIZE   (1024 * 1024)
+
+/* Memory for the quantizer and huffman tables shared by the decoded images [bytes]
+ * (images from the same encoder use the tables built for the first one instead
+ * of rebuilding them, about 5 KB holds the tables of an encoder), 0 to disable */
+#define LV_TJPGD_TABLE_CACHE_SIZE       (8 * 1024)
+
 /*********************
  *      DEFINES
  *********************/
@@ -61,6 +74,13 @@ extern "C" {
  *      TYPEDEFS
  **********************/
 
+/* Motion-JPEG player */
+typedef struct _lv_tjpgd_mjpeg_t lv_tjpgd_mjpeg_t;
+
+/* Allocator of the decoder buffers */
+typedef void * (*lv_tjpgd_alloc_cb_t)(size_t size);
+typedef void (*lv_tjpgd_free_cb_t)(void * p);
+
 /**********************
  * GLOBAL PROTOTYPES
  **********************/
@@ -70,6 +90,142 @@ extern "C" {
  */
 void lv_tjpgd_init(void);
 
+/**
+ * Set the scaling factor of the images decoded from now on.
+ *
+ * @param scale 0: none, 1: 1/2, 2: 1/4, 3: 1/8
+ */
+void lv_tjpgd_set_scale(uint8_t scale);
+
+/**
+ * Set the output pixel format of the images decoded from now on.
+ *
+ * @param format JD_FMT_RGB888, JD_FMT_RGB565, JD_FMT_RGB565_SWAP, JD_FMT_ARGB8888,
+ *               JD_FMT_GRAY8, JD_FMT_GRAY4 or JD_FMT_MONO1
+ *               (the one matching LV_COLOR_DEPTH and LV_COLOR_16_SWAP is drawn directly,
+ *               grayscale ones are drawn as indexed images with a gray palette and
+ *               skip decoding the color components)
+ */
+void lv_tjpgd_set_format(uint8_t format);
+
+/**
+ * Enable ordered dithering of the RGB565 images decoded from now on.
+ * It hides the banding of gradients at no extra memory cost.
+ *
+ * @param en true: dither, false: truncate (default)
+ */
+void lv_tjpgd_set_dither(bool en);
+
+/**
+ * Enable smooth chroma upsampling of the images decoded from now on.
+ * Color edges of 4:2:0, 4:2:2 and 4:4:0 images are interpolated instead of
+ * being blocky, at some decoding speed and an MCU row of decoded blocks in
+ * the work buffer. Images it does not fit for are upsampled by pixel
+ * replication.
+ *
+ * @param en true: triangle filter, false: pixel replication (default)
+ */
+void lv_tjpgd_set_fancy_upsampling(bool en);
+
+/**
+ * Set the box the decoded images have to fit in.
+ * Bigger images are reduced (keeping their aspect ratio) while decoding,
+ * smaller ones are left untouched. The scaling factor configuration is
+ * ignored while a box is set.
+ *
+ * @param w width of the box, 0 to disable fitting
+ * @param h height of the box, 0 to disable fitting
+ */
+void lv_tjpgd_set_fit_size(lv_coord_t w, lv_coord_t h);
+
+/**
+ * Enable decoding the EXIF thumbnail of the images decoded from now on.
+ * When the image is reduced (by the box or the scaling factor) to a size the
+ * embedded thumbnail of camera JPGs covers with the same aspect ratio, the
+ * thumbnail is reduced instead of decoding the main image.
+ *
+ * @param en true: use the thumbnail when possible (default), false: always decode the main image
+ */
+void lv_tjpgd_set_thumbnail(bool en);
+
+/**
+ * Enable decoding the images decoded from now on in the orientation of their
+ * EXIF Orientation tag (photos taken with a rotated camera).
+ * Rotation and mirroring are done while writing the decoded pixels, with no
+ * extra pass over the image. The fit box applies to the rotated image.
+ *
+ * @param en true: rotate and mirror as tagged (default), false: decode as stored
+ */
+void lv_tjpgd_set_exif_orientation(bool en);
+
+/**
+ * Set the rotation of the display panel the images decoded from now on are shown on.
+ * The decoded image is written rotated clockwise (after the EXIF orientation),
+ * so it is already in the native orientation of a panel mounted rotated and
+ * LVGL does not have to rotate JPG content on every flush. The reported image
+ * size is the rotated one, the fit box applies to the image before rotating.
+ *
+ * @param rot 0: none (default), 1: 90, 2: 180, 3: 270 degrees clockwise
+ */
+void lv_tjpgd_set_rotation(uint8_t rot);
+
+/**
+ * Open a Motion-JPEG stream (JPG frames one after another, e.g. recorded from
+ * a USB camera) to be played on a canvas.
+ * The decoding session is kept over the frames: tables and buffers are not
+ * rebuilt, frames without DHT segment use the standard huffman tables.
+ * Frames are decoded into one of two frame buffers while the other is shown,
+ * all frames must have the size of the first one (others are skipped).
+ * The frames are written in the EXIF orientation of the first frame and the
+ * display rotation set when the stream is opened (see lv_tjpgd_set_exif_orientation
+ * and lv_tjpgd_set_rotation), rotating by 90 or 270 degrees swaps the canvas size.
+ * Only displays with 16 or 32-bit colors are supported.
+ *
+ * @param fn file name of the stream
+ * @param canvas canvas to show the frames on, its buffer is set to the frame buffers
+ * @param period time between the frames [ms], 0 to decode the frames with
+ *               lv_tjpgd_mjpeg_next_frame only
+ * @return pointer to the player, NULL on error
+ */
+lv_tjpgd_mjpeg_t * lv_tjpgd_mjpeg_open(const char * fn, lv_obj_t * canvas, uint32_t period);
+
+/**
+ * Decode the next frame of a Motion-JPEG stream and show it.
+ * The stream starts over at its end.
+ *
+ * @param mj pointer to the player
+ * @return LV_RES_OK: the frame is shown; LV_RES_INV: the frame is skipped
+ */
+lv_res_t lv_tjpgd_mjpeg_next_frame(lv_tjpgd_mjpeg_t * mj);
+
+/**
+ * Stop playing a Motion-JPEG stream and free the player.
+ * The canvas is left with a freed buffer, set another buffer or delete it.
+ *
+ * @param mj pointer to the player
+ */
+void lv_tjpgd_mjpeg_close(lv_tjpgd_mjpeg_t * mj);
+
+/**
+ * Set the functions the buffers of the decoder are allocated and freed with
+ * (decoded images, work buffer, table cache, coefficient buffer and
+ * Motion-JPEG players). The work buffer, table cache and coefficient buffer
+ * are allocated at the first decode and reused by the next ones, so decoding
+ * only allocates the decoded image once they are big enough.
+ * Set them before decoding any image.
+ *
+ * @param alloc_cb function allocating a buffer, NULL to use lv_mem_alloc (default)
+ * @param free_cb function freeing a buffer, NULL to use lv_mem_free (default)
+ */
+void lv_tjpgd_set_allocator(lv_tjpgd_alloc_cb_t alloc_cb, lv_tjpgd_free_cb_t free_cb);
+
+/**
+ * Release the buffers kept over the decodes (work buffer, table cache and
+ * coefficient buffer), e.g. to get memory back after showing a slideshow.
+ * The next decode allocates them again.
+ */
+void lv_tjpgd_release_buffers(void);
+
 /**********************
  *      MACROS
  **********************/
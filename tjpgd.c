@@ -28,6 +28,16 @@
 
 #define ZIG(n)	Zig[n]
 
+#define HUFF_BIT	9	/* Bit length of the fast huffman decoding table index */
+#define HUFF_MAX(c)	((c) ? 256 : 16)	/* Largest number of code words of a huffman table [dcac] */
+
+#define SZ_MAX		((jd_size_t)-1)	/* Largest memory block allocated from the pool */
+#if JD_SIZE32
+#define SZ_OVER(n)	0				/* 32-bit sizes always fit in size_t */
+#else
+#define SZ_OVER(n)	((n) > SZ_MAX)	/* Size does not fit in the 16-bit size type */
+#endif
+
 static const uint8_t Zig[64] = {	/* Zigzag-order to raster-order conversion table */
 	 0,  1,  8, 16,  9,  2,  3, 10, 17, 24, 32, 25, 18, 11,  4,  5,
 	12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13,  6,  7, 14, 21, 28,
@@ -120,13 +130,375 @@ inline uint8_t BYTECLIP (
 
 
 
+/*-----------------------------------------------*/
+/* Threshold map for ordered dithering           */
+/*-----------------------------------------------*/
+
+static const uint8_t Bayer4[4][4] = {	/* 4x4 Bayer matrix (0 to 15) */
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 }
+};
+
+
+
+/*-----------------------------------------------*/
+/* Size of the output pixel formats              */
+/*-----------------------------------------------*/
+
+static const uint8_t Fmtbit[7] = {	/* Bits per pixel [JD_FMT_*] */
+	24, 16, 32, 16, 8, 4, 1
+};
+
+
+
+/*-----------------------------------------------*/
+/* Output transform of orientation and rotation  */
+/*-----------------------------------------------*/
+
+static const uint8_t Orient[9] = {	/* bit0:mirror horizontally, bit1:mirror vertically, bit2:then transpose */
+	0, 0, 1, 3, 2, 4, 6, 7, 5
+};
+
+static const uint8_t Rotate[4] = {	/* Display rotation of 0, 90, 180 and 270 degrees clockwise */
+	0, 6, 3, 5
+};
+
+
+
+/*-----------------------------------------------*/
+/* Standard huffman tables (T.81 Annex K.3)      */
+/*-----------------------------------------------*/
+
+#if JD_USE_STDHUFF
+static const uint8_t StdBits[2][2][16] = {	/* Number of code words of 1 to 16-bit [id][dcac] (0:luminance, 1:chrominance) */
+	{
+		{   0,   1,   5,   1,   1,   1,   1,   1,   1,   0,   0,   0,   0,   0,   0,   0 },
+		{   0,   2,   1,   3,   3,   2,   4,   3,   5,   5,   4,   4,   0,   0,   1, 125 }
+	},
+	{
+		{   0,   3,   1,   1,   1,   1,   1,   1,   1,   1,   1,   0,   0,   0,   0,   0 },
+		{   0,   2,   1,   2,   4,   4,   3,   4,   7,   5,   4,   4,   0,   1,   2, 119 }
+	}
+};
+
+static const uint16_t StdDcCode[2][12] = {	/* DC code words [id] */
+	{
+		0x0000, 0x0002, 0x0003, 0x0004, 0x0005, 0x0006, 0x000E, 0x001E,
+		0x003E, 0x007E, 0x00FE, 0x01FE
+	},
+	{
+		0x0000, 0x0001, 0x0002, 0x0006, 0x000E, 0x001E, 0x003E, 0x007E,
+		0x00FE, 0x01FE, 0x03FE, 0x07FE
+	}
+};
+
+static const uint8_t StdDcData[2][12] = {	/* DC decoded data [id] */
+	{
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B
+	},
+	{
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B
+	}
+};
+
+static const uint16_t StdAcCode[2][162] = {	/* AC code words [id] */
+	{
+		0x0000, 0x0001, 0x0004, 0x000A, 0x000B, 0x000C, 0x001A, 0x001B,
+		0x001C, 0x003A, 0x003B, 0x0078, 0x0079, 0x007A, 0x007B, 0x00F8,
+		0x00F9, 0x00FA, 0x01F6, 0x01F7, 0x01F8, 0x01F9, 0x01FA, 0x03F6,
+		0x03F7, 0x03F8, 0x03F9, 0x03FA, 0x07F6, 0x07F7, 0x07F8, 0x07F9,
+		0x0FF4, 0x0FF5, 0x0FF6, 0x0FF7, 0x7FC0, 0xFF82, 0xFF83, 0xFF84,
+		0xFF85, 0xFF86, 0xFF87, 0xFF88, 0xFF89, 0xFF8A, 0xFF8B, 0xFF8C,
+		0xFF8D, 0xFF8E, 0xFF8F, 0xFF90, 0xFF91, 0xFF92, 0xFF93, 0xFF94,
+		0xFF95, 0xFF96, 0xFF97, 0xFF98, 0xFF99, 0xFF9A, 0xFF9B, 0xFF9C,
+		0xFF9D, 0xFF9E, 0xFF9F, 0xFFA0, 0xFFA1, 0xFFA2, 0xFFA3, 0xFFA4,
+		0xFFA5, 0xFFA6, 0xFFA7, 0xFFA8, 0xFFA9, 0xFFAA, 0xFFAB, 0xFFAC,
+		0xFFAD, 0xFFAE, 0xFFAF, 0xFFB0, 0xFFB1, 0xFFB2, 0xFFB3, 0xFFB4,
+		0xFFB5, 0xFFB6, 0xFFB7, 0xFFB8, 0xFFB9, 0xFFBA, 0xFFBB, 0xFFBC,
+		0xFFBD, 0xFFBE, 0xFFBF, 0xFFC0, 0xFFC1, 0xFFC2, 0xFFC3, 0xFFC4,
+		0xFFC5, 0xFFC6, 0xFFC7, 0xFFC8, 0xFFC9, 0xFFCA, 0xFFCB, 0xFFCC,
+		0xFFCD, 0xFFCE, 0xFFCF, 0xFFD0, 0xFFD1, 0xFFD2, 0xFFD3, 0xFFD4,
+		0xFFD5, 0xFFD6, 0xFFD7, 0xFFD8, 0xFFD9, 0xFFDA, 0xFFDB, 0xFFDC,
+		0xFFDD, 0xFFDE, 0xFFDF, 0xFFE0, 0xFFE1, 0xFFE2, 0xFFE3, 0xFFE4,
+		0xFFE5, 0xFFE6, 0xFFE7, 0xFFE8, 0xFFE9, 0xFFEA, 0xFFEB, 0xFFEC,
+		0xFFED, 0xFFEE, 0xFFEF, 0xFFF0, 0xFFF1, 0xFFF2, 0xFFF3, 0xFFF4,
+		0xFFF5, 0xFFF6, 0xFFF7, 0xFFF8, 0xFFF9, 0xFFFA, 0xFFFB, 0xFFFC,
+		0xFFFD, 0xFFFE
+	},
+	{
+		0x0000, 0x0001, 0x0004, 0x000A, 0x000B, 0x0018, 0x0019, 0x001A,
+		0x001B, 0x0038, 0x0039, 0x003A, 0x003B, 0x0078, 0x0079, 0x007A,
+		0x00F6, 0x00F7, 0x00F8, 0x00F9, 0x01F4, 0x01F5, 0x01F6, 0x01F7,
+		0x01F8, 0x01F9, 0x01FA, 0x03F6, 0x03F7, 0x03F8, 0x03F9, 0x03FA,
+		0x07F6, 0x07F7, 0x07F8, 0x07F9, 0x0FF4, 0x0FF5, 0x0FF6, 0x0FF7,
+		0x3FE0, 0x7FC2, 0x7FC3, 0xFF88, 0xFF89, 0xFF8A, 0xFF8B, 0xFF8C,
+		0xFF8D, 0xFF8E, 0xFF8F, 0xFF90, 0xFF91, 0xFF92, 0xFF93, 0xFF94,
+		0xFF95, 0xFF96, 0xFF97, 0xFF98, 0xFF99, 0xFF9A, 0xFF9B, 0xFF9C,
+		0xFF9D, 0xFF9E, 0xFF9F, 0xFFA0, 0xFFA1, 0xFFA2, 0xFFA3, 0xFFA4,
+		0xFFA5, 0xFFA6, 0xFFA7, 0xFFA8, 0xFFA9, 0xFFAA, 0xFFAB, 0xFFAC,
+		0xFFAD, 0xFFAE, 0xFFAF, 0xFFB0, 0xFFB1, 0xFFB2, 0xFFB3, 0xFFB4,
+		0xFFB5, 0xFFB6, 0xFFB7, 0xFFB8, 0xFFB9, 0xFFBA, 0xFFBB, 0xFFBC,
+		0xFFBD, 0xFFBE, 0xFFBF, 0xFFC0, 0xFFC1, 0xFFC2, 0xFFC3, 0xFFC4,
+		0xFFC5, 0xFFC6, 0xFFC7, 0xFFC8, 0xFFC9, 0xFFCA, 0xFFCB, 0xFFCC,
+		0xFFCD, 0xFFCE, 0xFFCF, 0xFFD0, 0xFFD1, 0xFFD2, 0xFFD3, 0xFFD4,
+		0xFFD5, 0xFFD6, 0xFFD7, 0xFFD8, 0xFFD9, 0xFFDA, 0xFFDB, 0xFFDC,
+		0xFFDD, 0xFFDE, 0xFFDF, 0xFFE0, 0xFFE1, 0xFFE2, 0xFFE3, 0xFFE4,
+		0xFFE5, 0xFFE6, 0xFFE7, 0xFFE8, 0xFFE9, 0xFFEA, 0xFFEB, 0xFFEC,
+		0xFFED, 0xFFEE, 0xFFEF, 0xFFF0, 0xFFF1, 0xFFF2, 0xFFF3, 0xFFF4,
+		0xFFF5, 0xFFF6, 0xFFF7, 0xFFF8, 0xFFF9, 0xFFFA, 0xFFFB, 0xFFFC,
+		0xFFFD, 0xFFFE
+	}
+};
+
+static const uint8_t StdAcData[2][162] = {	/* AC decoded data [id] */
+	{
+		0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+		0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52, 0xD1, 0xF0,
+		0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26, 0x27, 0x28,
+		0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+		0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+		0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+		0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5, 0xA6, 0xA7,
+		0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3, 0xC4, 0xC5,
+		0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA, 0xE1, 0xE2,
+		0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+		0xF9, 0xFA
+	},
+	{
+		0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+		0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33, 0x52, 0xF0,
+		0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19, 0x1A, 0x26,
+		0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+		0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+		0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+		0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+		0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+		0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+		0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF8,
+		0xF9, 0xFA
+	}
+};
+
+#if JD_FASTDECODE
+static const uint8_t StdDcLut[2][1 << HUFF_BIT] = {	/* Fast decoding tables of DC code length << 4 | data [id] */
+	{
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+		0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+		0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+		0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31,
+		0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+		0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+		0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+		0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34,
+		0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34,
+		0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34,
+		0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34,
+		0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35,
+		0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35,
+		0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35,
+		0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35,
+		0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46,
+		0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46, 0x46,
+		0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57, 0x57,
+		0x68, 0x68, 0x68, 0x68, 0x68, 0x68, 0x68, 0x68, 0x79, 0x79, 0x79, 0x79, 0x8A, 0x8A, 0x9B, 0x00
+	},
+	{
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33,
+		0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+		0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44, 0x44,
+		0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55, 0x55,
+		0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x66, 0x77, 0x77, 0x77, 0x77, 0x88, 0x88, 0x99, 0x00
+	}
+};
+
+static const uint16_t StdAcLut[2][1 << HUFF_BIT] = {	/* Fast decoding tables of AC code length << 8 | data [id] */
+	{
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202, 0x0202,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303, 0x0303,
+		0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+		0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+		0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+		0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400, 0x0400,
+		0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404,
+		0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404,
+		0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404,
+		0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404, 0x0404,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505,
+		0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505,
+		0x0512, 0x0512, 0x0512, 0x0512, 0x0512, 0x0512, 0x0512, 0x0512,
+		0x0512, 0x0512, 0x0512, 0x0512, 0x0512, 0x0512, 0x0512, 0x0512,
+		0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521,
+		0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521,
+		0x0631, 0x0631, 0x0631, 0x0631, 0x0631, 0x0631, 0x0631, 0x0631,
+		0x0641, 0x0641, 0x0641, 0x0641, 0x0641, 0x0641, 0x0641, 0x0641,
+		0x0706, 0x0706, 0x0706, 0x0706, 0x0713, 0x0713, 0x0713, 0x0713,
+		0x0751, 0x0751, 0x0751, 0x0751, 0x0761, 0x0761, 0x0761, 0x0761,
+		0x0807, 0x0807, 0x0822, 0x0822, 0x0871, 0x0871, 0x0914, 0x0932,
+		0x0981, 0x0991, 0x09A1, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+	},
+	{
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200, 0x0200,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201, 0x0201,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302, 0x0302,
+		0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403,
+		0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403,
+		0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403,
+		0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403, 0x0403,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411, 0x0411,
+		0x0504, 0x0504, 0x0504, 0x0504, 0x0504, 0x0504, 0x0504, 0x0504,
+		0x0504, 0x0504, 0x0504, 0x0504, 0x0504, 0x0504, 0x0504, 0x0504,
+		0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505,
+		0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505, 0x0505,
+		0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521,
+		0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521, 0x0521,
+		0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531,
+		0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531, 0x0531,
+		0x0606, 0x0606, 0x0606, 0x0606, 0x0606, 0x0606, 0x0606, 0x0606,
+		0x0612, 0x0612, 0x0612, 0x0612, 0x0612, 0x0612, 0x0612, 0x0612,
+		0x0641, 0x0641, 0x0641, 0x0641, 0x0641, 0x0641, 0x0641, 0x0641,
+		0x0651, 0x0651, 0x0651, 0x0651, 0x0651, 0x0651, 0x0651, 0x0651,
+		0x0707, 0x0707, 0x0707, 0x0707, 0x0761, 0x0761, 0x0761, 0x0761,
+		0x0771, 0x0771, 0x0771, 0x0771, 0x0813, 0x0813, 0x0822, 0x0822,
+		0x0832, 0x0832, 0x0881, 0x0881, 0x0908, 0x0914, 0x0942, 0x0991,
+		0x09A1, 0x09B1, 0x09C1, 0x0000, 0x0000, 0x0000, 0x0000, 0x0000
+	}
+};
+#endif
+#endif
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Allocate a memory block from memory pool                              */
 /*-----------------------------------------------------------------------*/
 
 static void* alloc_pool (	/* Pointer to allocated memory block (NULL:no memory available) */
 	JDEC* jd,		/* Pointer to the decompressor object */
-	uint16_t nd		/* Number of bytes to allocate */
+	jd_size_t nd	/* Number of bytes to allocate */
 )
 {
 	char *rp = 0;
@@ -136,8 +508,12 @@ static void* alloc_pool (	/* Pointer to allocated memory block (NULL:no memory a
 
 	if (jd->sz_pool >= nd) {
 		jd->sz_pool -= nd;
-		rp = (char*)jd->pool;			/* Get start of available memory pool */
-		jd->pool = (void*)(rp + nd);	/* Allocate requierd bytes */
+		if (jd->ptop) {					/* Tables kept over the frames of Motion-JPEG are taken from end of the pool */
+			rp = (char*)jd->pool + jd->sz_pool;
+		} else {
+			rp = (char*)jd->pool;			/* Get start of available memory pool */
+			jd->pool = (void*)(rp + nd);	/* Allocate requierd bytes */
+		}
 	}
 
 	return (void*)rp;	/* Return allocated memory block (NULL:no memory to allocate) */
@@ -146,6 +522,106 @@ static void* alloc_pool (	/* Pointer to allocated memory block (NULL:no memory a
 
 
 
+#if JD_USE_CACHE
+/*-----------------------------------------------------------------------*/
+/* Find and store the tables in the table cache                          */
+/*-----------------------------------------------------------------------*/
+
+typedef struct JDCTBL JDCTBL;
+struct JDCTBL {			/* Cached table */
+	JDCTBL* next;		/* Next table in the cache */
+	uint32_t hash;		/* Hash of the table definition */
+	uint16_t type;		/* Table type (0:huffman DC, 1:huffman AC, 2:dequantizer) */
+	void* tbl[4];		/* Dequantizer table, or bit distribution, code word, decoded data and fast decoding tables */
+};
+
+
+static uint32_t tbl_hash (	/* Hash of the table definition (FNV-1a) */
+	uint16_t type,			/* Table type */
+	const uint8_t* data,	/* Table definition in the marker segment */
+	uint16_t ndata			/* Size of the table definition */
+)
+{
+	uint32_t h = 0x811C9DC5 ^ type;
+
+
+	while (ndata--) h = (h ^ *data++) * 0x01000193;
+
+	return h;
+}
+
+
+static const JDCTBL* cache_find (	/* Pointer to the cached table (NULL:not found) */
+	const JDCACHE* cache,	/* Table cache (NULL:not used) */
+	uint16_t type,			/* Table type */
+	uint32_t hash,			/* Hash of the table definition */
+	const uint8_t* data		/* Table definition in the marker segment */
+)
+{
+	const JDCTBL* ct;
+	const uint8_t *p;
+	uint16_t i, n;
+
+
+	for (ct = cache ? cache->list : 0; ct; ct = ct->next) {
+		if (ct->hash != hash || ct->type != type) continue;
+		if (type == 2) {	/* Compare the dequantizer table */
+			for (i = 0; i < 64 && ((int32_t*)ct->tbl[0])[ZIG(i)] == (int32_t)((uint32_t)data[i] * IPSF(ZIG(i))); i++) ;
+			if (i == 64) break;
+		} else {			/* Compare the bit distribution and decoded data of the huffman table */
+			p = ct->tbl[0];
+			for (n = i = 0; i < 16 && p[i] == data[i]; n += p[i++]) ;
+			if (i < 16) continue;
+			p = ct->tbl[2];
+			for (i = 0; i < n && p[i] == data[16 + i]; i++) ;
+			if (i == n) break;
+		}
+	}
+
+	return ct;
+}
+
+
+static void cache_store (
+	JDCACHE* cache,			/* Table cache (NULL:not used) */
+	uint16_t type,			/* Table type */
+	uint32_t hash,			/* Hash of the table definition */
+	void* const* tbl,		/* Tables to be copied into the cache */
+	const uint16_t* sz,		/* Size of each table */
+	uint16_t ntbl			/* Number of tables */
+)
+{
+	JDCTBL* ct;
+	uint8_t *p;
+	const uint8_t *s;
+	uint16_t i, n;
+	jd_size_t nd;
+
+
+	if (!cache || cache->lock) return;	/* Read-only cache */
+	nd = (sizeof (JDCTBL) + 3) & ~3;
+	for (i = 0; i < ntbl; i++) nd += (sz[i] + 3) & ~3;	/* Size of the tables aligned to the word boundary */
+	if (cache->sz_pool < nd) return;	/* No room in the cache */
+	cache->sz_pool -= nd;
+
+	ct = cache->pool;					/* Allocate the tables from the memory of the cache */
+	p = (uint8_t*)ct + ((sizeof (JDCTBL) + 3) & ~3);
+	for (i = 0; i < ntbl; i++) {
+		ct->tbl[i] = p;
+		for (s = tbl[i], n = 0; n < sz[i]; n++) p[n] = s[n];	/* Copy the table */
+		p += (sz[i] + 3) & ~3;
+	}
+	cache->pool = p;
+	ct->hash = hash;
+	ct->type = type;
+	ct->next = cache->list;				/* Register the tables */
+	cache->list = ct;
+}
+#endif
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Create de-quantization and prescaling tables with a DQT segment       */
 /*-----------------------------------------------------------------------*/
@@ -159,6 +635,11 @@ static int create_qt_tbl (	/* 0:OK, !0:Failed */
 	uint16_t i;
 	uint8_t d, z;
 	int32_t *pb;
+#if JD_USE_CACHE
+	const JDCTBL* ct;
+	uint32_t h;
+	uint16_t sz = 64 * sizeof (int32_t);
+#endif
 
 
 	while (ndata) {	/* Process all tables in the segment */
@@ -167,13 +648,30 @@ static int create_qt_tbl (	/* 0:OK, !0:Failed */
 		d = *data++;							/* Get table property */
 		if (d & 0xF0) return JDR_FMT1;			/* Err: not 8-bit resolution */
 		i = d & 3;								/* Get table ID */
-		pb = alloc_pool(jd, 64 * sizeof (int32_t));/* Allocate a memory block for the table */
-		if (!pb) return JDR_MEM1;				/* Err: not enough memory */
-		jd->qttbl[i] = pb;						/* Register the table */
+#if JD_USE_CACHE
+		h = tbl_hash(2, data, 64);
+		ct = (jd->progressive || jd->ptop) ? 0 : cache_find(jd->cache, 2, h, data);	/* Tables of progressive JPEG and Motion-JPEG are redefined in place scan by scan or frame by frame */
+		if (ct) {								/* Use the cached table */
+			jd->qttbl[i] = ct->tbl[0];
+			jd->tblro |= 1 << i;
+			data += 64;
+			continue;
+		}
+#endif
+		pb = jd->qttbl[i];						/* Reuse the memory block of the table if redefined */
+		if (!pb || (jd->tblro & 1 << i)) {
+			pb = alloc_pool(jd, 64 * sizeof (int32_t));/* Allocate a memory block for the table */
+			if (!pb) return JDR_MEM1;			/* Err: not enough memory */
+			jd->qttbl[i] = pb;					/* Register the table */
+			jd->tblro &= ~(1 << i);
+		}
 		for (i = 0; i < 64; i++) {				/* Load the table */
 			z = ZIG(i);							/* Zigzag-order to raster-order conversion */
 			pb[z] = (int32_t)((uint32_t)*data++ * IPSF(z));	/* Apply scale factor of Arai algorithm to the de-quantizers */
 		}
+#if JD_USE_CACHE
+		if (!jd->progressive && !jd->ptop) cache_store(jd->cache, 2, h, (void* const*)&pb, &sz, 1);	/* Add the table to the cache (not looked up when redefined in place) */
+#endif
 	}
 
 	return JDR_OK;
@@ -192,26 +690,71 @@ static int create_huffman_tbl (	/* 0:OK, !0:Failed */
 	uint16_t ndata				/* Size of input data */
 )
 {
-	uint16_t i, j, b, np, cls, num;
+	uint16_t i, j, b, np, op, cls, num;
 	uint8_t d, *pb, *pd;
 	uint16_t hc, *ph;
+#if JD_USE_CACHE
+	const JDCTBL* ct;
+	uint32_t h = 0;
+	void* tbl[4];
+	uint16_t sz[4];
+#endif
 
 
 	while (ndata) {	/* Process all tables in the segment */
 		if (ndata < 17) return JDR_FMT1;	/* Err: wrong data size */
 		ndata -= 17;
 		d = *data++;						/* Get table number and class */
-		if (d & 0xEE) return JDR_FMT1;		/* Err: invalid class/number */
-		cls = d >> 4; num = d & 0x0F;		/* class = dc(0)/ac(1), table number = 0/1 */
-		pb = alloc_pool(jd, 16);			/* Allocate a memory block for the bit distribution table */
-		if (!pb) return JDR_MEM1;			/* Err: not enough memory */
-		jd->huffbits[num][cls] = pb;
-		for (np = i = 0; i < 16; i++) {		/* Load number of patterns for 1 to 16-bit code */
-			np += (pb[i] = *data++);		/* Get sum of code words for each code */
-		}
-		ph = alloc_pool(jd, (uint16_t)(np * sizeof (uint16_t)));/* Allocate a memory block for the code word table */
-		if (!ph) return JDR_MEM1;			/* Err: not enough memory */
-		jd->huffcode[num][cls] = ph;
+		if (d & 0xEC) return JDR_FMT1;		/* Err: invalid class/number */
+		cls = d >> 4; num = d & 0x0F;		/* class = dc(0)/ac(1), table number = 0 to 3 */
+		for (np = i = 0; i < 16; i++) np += data[i];	/* Number of code words */
+		if (np > HUFF_MAX(cls)) return JDR_FMT1;	/* Err: more code words than symbols */
+#if JD_USE_CACHE
+		if (np <= ndata) {
+			h = tbl_hash(cls, data, 16 + np);
+			ct = (jd->progressive || jd->ptop) ? 0 : cache_find(jd->cache, cls, h, data);	/* Tables of progressive JPEG and Motion-JPEG are redefined in place scan by scan or frame by frame */
+			if (ct) {						/* Use the cached tables */
+				jd->huffbits[num][cls] = ct->tbl[0];
+				jd->huffcode[num][cls] = ct->tbl[1];
+				jd->huffdata[num][cls] = ct->tbl[2];
+#if JD_FASTDECODE
+				jd->hufflut[num][cls] = ct->tbl[3];
+#endif
+				jd->tblro |= 0x10 << (num * 2 + cls);
+				jd->tblfull &= ~(1 << (num * 2 + cls));
+				data += 16 + np; ndata -= np;
+				continue;
+			}
+		}
+#endif
+		pb = jd->huffbits[num][cls];		/* Table to be redefined (progressive JPEG defines tables for each scan) */
+		if (jd->tblro & 0x10 << (num * 2 + cls)) {	/* Shared tables (standard or cached) are not rebuilt in place */
+			pb = 0;
+#if JD_FASTDECODE
+			jd->hufflut[num][cls] = 0;
+#endif
+		}
+		for (op = i = 0; pb && i < 16; i++) op += pb[i];	/* Number of code words of the table */
+		if (!pb || (op < np && !(jd->tblfull & 1 << (num * 2 + cls)))) {	/* Allocate new memory blocks if the table is not defined or too small */
+			op = (jd->progressive || jd->ptop) ? HUFF_MAX(cls) : np;	/* Tables redefined in place (progressive JPEG and Motion-JPEG) are allocated in full size */
+			pb = alloc_pool(jd, 16);		/* Allocate a memory block for the bit distribution table */
+			ph = alloc_pool(jd, (uint16_t)(op * sizeof (uint16_t)));/* Allocate a memory block for the code word table */
+			pd = alloc_pool(jd, op);		/* Allocate a memory block for the decoded data */
+			if (!pb || !ph || !pd) return JDR_MEM1;	/* Err: not enough memory */
+			jd->huffbits[num][cls] = pb;
+			jd->huffcode[num][cls] = ph;
+			jd->huffdata[num][cls] = pd;
+			jd->tblro &= ~(0x10 << (num * 2 + cls));
+			if (jd->progressive || jd->ptop) {
+				jd->tblfull |= 1 << (num * 2 + cls);
+			} else {
+				jd->tblfull &= ~(1 << (num * 2 + cls));
+			}
+		} else {							/* Reuse the memory blocks of the table */
+			ph = jd->huffcode[num][cls];
+			pd = jd->huffdata[num][cls];
+		}
+		for (i = 0; i < 16; i++) pb[i] = *data++;	/* Load number of patterns for 1 to 16-bit code */
 		hc = 0;
 		for (j = i = 0; i < 16; i++) {		/* Re-build huffman code word table */
 			b = pb[i];
@@ -221,14 +764,51 @@ static int create_huffman_tbl (	/* 0:OK, !0:Failed */
 
 		if (ndata < np) return JDR_FMT1;	/* Err: wrong data size */
 		ndata -= np;
-		pd = alloc_pool(jd, np);			/* Allocate a memory block for the decoded data */
-		if (!pd) return JDR_MEM1;			/* Err: not enough memory */
-		jd->huffdata[num][cls] = pd;
 		for (i = 0; i < np; i++) {			/* Load decoded data corresponds to each code ward */
 			d = *data++;
 			if (!cls && d > 11) return JDR_FMT1;
 			*pd++ = d;
 		}
+
+#if JD_FASTDECODE
+		/* Create the fast lookup table of the codes up to HUFF_BIT bits */
+		if (!jd->hufflut[num][cls]) {
+			jd->hufflut[num][cls] = alloc_pool(jd, (uint16_t)((cls ? 2 : 1) << HUFF_BIT));
+			if (!jd->hufflut[num][cls]) return JDR_MEM1;	/* Err: not enough memory */
+		}
+		pd -= np;
+		for (i = 0; i < 1 << HUFF_BIT; i++) {	/* Codes longer than HUFF_BIT bits are not in the table */
+			if (cls) {
+				((uint16_t*)jd->hufflut[num][cls])[i] = 0;
+			} else {
+				((uint8_t*)jd->hufflut[num][cls])[i] = 0;
+			}
+		}
+		for (j = 0, b = 1; b <= HUFF_BIT; b++) {	/* Each code length */
+			for (i = pb[b - 1]; i; i--, j++) {		/* Each code word of the length */
+				if (ph[j] >> b) return JDR_FMT1;	/* Err: code word overflow (collapted table) */
+				hc = ph[j] << (HUFF_BIT - b);		/* Fill all entries starting with the code word */
+				for (op = 0; op < 1 << (HUFF_BIT - b); op++, hc++) {
+					if (cls) {
+						((uint16_t*)jd->hufflut[num][cls])[hc] = (uint16_t)(b << 8 | pd[j]);	/* Code length and AC data */
+					} else {
+						((uint8_t*)jd->hufflut[num][cls])[hc] = (uint8_t)(b << 4 | pd[j]);	/* Code length and DC data */
+					}
+				}
+			}
+		}
+#endif
+#if JD_USE_CACHE
+		if (!jd->progressive && !jd->ptop) {	/* Add the tables to the cache (not looked up when redefined in place) */
+			tbl[0] = pb; sz[0] = 16;
+			tbl[1] = ph; sz[1] = (uint16_t)(np * sizeof (uint16_t));
+			tbl[2] = jd->huffdata[num][cls]; sz[2] = np;
+#if JD_FASTDECODE
+			tbl[3] = jd->hufflut[num][cls]; sz[3] = (uint16_t)((cls ? 2 : 1) << HUFF_BIT);
+#endif
+			cache_store(jd->cache, cls, h, tbl, sz, 3 + JD_FASTDECODE);
+		}
+#endif
 	}
 
 	return JDR_OK;
@@ -238,259 +818,743 @@ static int create_huffman_tbl (	/* 0:OK, !0:Failed */
 
 
 /*-----------------------------------------------------------------------*/
-/* Extract N bits from input stream                                      */
+/* Use the standard huffman tables for the tables not defined            */
 /*-----------------------------------------------------------------------*/
 
-static int bitext (	/* >=0: extracted data, <0: error code */
-	JDEC* jd,		/* Pointer to the decompressor object */
-	int nbit		/* Number of bits to extract (1 to 11) */
+#if JD_USE_STDHUFF
+static void default_huffman_tbl (
+	JDEC* jd		/* Pointer to the decompressor object */
 )
 {
-	uint8_t msk, s, *dp;
-	uint16_t dc, v, f;
+	uint16_t i, j;
 
 
-	msk = jd->dmsk; dc = jd->dctr; dp = jd->dptr;	/* Bit mask, number of data available, read ptr */
-	s = *dp; v = f = 0;
-	do {
-		if (!msk) {				/* Next byte? */
-			if (!dc) {			/* No input data is available, re-fill input buffer */
-				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
-				if (!dc) return 0 - (int16_t)JDR_INP;	/* Err: read error or wrong stream termination */
-			} else {
-				dp++;			/* Next data ptr */
-			}
-			dc--;				/* Decrement number of available bytes */
-			if (f) {			/* In flag sequence? */
-				f = 0;			/* Exit flag sequence */
-				if (*dp != 0) return 0 - (int16_t)JDR_FMT1;	/* Err: unexpected flag is detected (may be collapted data) */
-				*dp = s = 0xFF;			/* The flag is a data 0xFF */
-			} else {
-				s = *dp;				/* Get next data byte */
-				if (s == 0xFF) {		/* Is start of flag sequence? */
-					f = 1; continue;	/* Enter flag sequence */
-				}
-			}
-			msk = 0x80;		/* Read from MSB */
+	for (i = 0; i < 2; i++) {	/* Luminance and chrominance tables */
+		for (j = 0; j < 2; j++) {	/* DC and AC tables */
+			if (jd->huffbits[i][j]) continue;	/* Use the table if the slot is empty */
+			jd->huffbits[i][j] = (uint8_t*)StdBits[i][j];	/* The tables are const data and not rebuilt in place */
+			jd->huffcode[i][j] = (uint16_t*)(j ? StdAcCode[i] : StdDcCode[i]);
+			jd->huffdata[i][j] = (uint8_t*)(j ? StdAcData[i] : StdDcData[i]);
+#if JD_FASTDECODE
+			jd->hufflut[i][j] = j ? (void*)StdAcLut[i] : (void*)StdDcLut[i];
+#endif
+			jd->tblro |= 0x10 << (i * 2 + j);
 		}
-		v <<= 1;	/* Get a bit */
-		if (s & msk) v++;
-		msk >>= 1;
-		nbit--;
-	} while (nbit);
-	jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp;
-
-	return (int)v;
+	}
 }
+#endif
 
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Extract a huffman decoded data from input stream                      */
+/* Get a byte from input stream                                          */
 /*-----------------------------------------------------------------------*/
 
-static int16_t huffext (	/* >=0: decoded data, <0: error code */
-	JDEC* jd,				/* Pointer to the decompressor object */
-	const uint8_t* hbits,	/* Pointer to the bit distribution table */
-	const uint16_t* hcode,	/* Pointer to the code word table */
-	const uint8_t* hdata	/* Pointer to the data table */
+static int getbyte (	/* >=0: a byte, <0: error code */
+	JDEC* jd		/* Pointer to the decompressor object */
 )
 {
-	uint8_t msk, s, *dp;
-	uint16_t dc, v, f, bl, nd;
+	if (!jd->dctr) {	/* No input data is available, re-fill input buffer */
+		jd->dptr = jd->inbuf;
+		jd->dctr = jd->infunc(jd, jd->dptr, JD_SZBUF);
+		if (!jd->dctr) return 0 - (int)JDR_INP;	/* Err: read error or wrong stream termination */
+	} else {
+		jd->dptr++;
+	}
+	jd->dctr--;
+
+	return *jd->dptr;
+}
 
 
-	msk = jd->dmsk; dc = jd->dctr; dp = jd->dptr;	/* Bit mask, number of data available, read ptr */
-	s = *dp; v = f = 0;
-	bl = 16;	/* Max code length */
-	do {
-		if (!msk) {		/* Next byte? */
-			if (!dc) {	/* No input data is available, re-fill input buffer */
-				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
-				if (!dc) return 0 - (int16_t)JDR_INP;	/* Err: read error or wrong stream termination */
-			} else {
-				dp++;	/* Next data ptr */
-			}
-			dc--;		/* Decrement number of available bytes */
-			if (f) {		/* In flag sequence? */
-				f = 0;		/* Exit flag sequence */
-				if (*dp != 0) return 0 - (int16_t)JDR_FMT1;	/* Err: unexpected flag is detected (may be collapted data) */
-				*dp = s = 0xFF;			/* The flag is a data 0xFF */
-			} else {
-				s = *dp;				/* Get next data byte */
-				if (s == 0xFF) {		/* Is start of flag sequence? */
-					f = 1; continue;	/* Enter flag sequence, get trailing byte */
-				}
-			}
-			msk = 0x80;		/* Read from MSB */
-		}
-		v <<= 1;	/* Get a bit */
-		if (s & msk) v++;
-		msk >>= 1;
 
-		for (nd = *hbits++; nd; nd--) {	/* Search the code word in this bit length */
-			if (v == *hcode++) {		/* Matched? */
-				jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp;
-				return *hdata;			/* Return the decoded data */
-			}
-			hdata++;
-		}
-		bl--;
-	} while (bl);
 
-	return 0 - (int16_t)JDR_FMT1;	/* Err: code not found (may be collapted data) */
+/*-----------------------------------------------------------------------*/
+/* Load or skip data of a marker segment                                 */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT seg_load (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint8_t* buf,	/* Buffer to store the data (NULL:skip the data) */
+	uint16_t len	/* Number of bytes to load */
+)
+{
+	uint16_t n;
+
+
+	n = (jd->dctr < len) ? jd->dctr : len;	/* Take the bytes left in the input buffer first */
+	jd->dctr -= n; len -= n;
+	if (buf) {
+		while (n--) *buf++ = *++jd->dptr;
+	} else {
+		jd->dptr += n;
+	}
+	if (len && jd->infunc(jd, buf, len) != len) return JDR_INP;	/* Rest of the data directly from the stream */
+
+	return JDR_OK;
 }
 
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Apply Inverse-DCT in Arai Algorithm (see also aa_idct.png)            */
+/* Get a byte of the entropy-coded data from input stream                */
 /*-----------------------------------------------------------------------*/
 
-static void block_idct (
-	int32_t* src,	/* Input block data (de-quantized and pre-scaled for Arai Algorithm) */
-	uint8_t* dst	/* Pointer to the destination to store the block as byte array */
+static int getdata (	/* >=0: a data byte, <0: error code */
+	JDEC* jd		/* Pointer to the decompressor object */
 )
 {
-	const int32_t M13 = (int32_t)(1.41421*4096), M2 = (int32_t)(1.08239*4096), M4 = (int32_t)(2.61313*4096), M5 = (int32_t)(1.84776*4096);
-	int32_t v0, v1, v2, v3, v4, v5, v6, v7;
-	int32_t t10, t11, t12, t13;
-	uint16_t i;
+	int d;
+
+
+	if (jd->marker) return 0;	/* Padding bytes after a marker */
+	d = getbyte(jd);
+	if (d == 0xFF) {	/* Is start of flag sequence? */
+		do {			/* Get trailing byte (0xFF can be repeated as fill bytes) */
+			d = getbyte(jd);
+		} while (d == 0xFF);
+		if (d > 0) {	/* A marker terminates the entropy-coded data */
+			jd->marker = (uint8_t)d;
+			d = 0;
+		} else if (d == 0) {	/* The flag is a data 0xFF */
+			d = 0xFF;
+		}
+	}
 
-	/* Process columns */
-	for (i = 0; i < 8; i++) {
-		v0 = src[8 * 0];	/* Get even elements */
-		v1 = src[8 * 2];
-		v2 = src[8 * 4];
-		v3 = src[8 * 6];
+	return d;
+}
 
-		t10 = v0 + v2;		/* Process the even elements */
-		t12 = v0 - v2;
-		t11 = (v1 - v3) * M13 >> 12;
-		v3 += v1;
-		t11 -= v3;
-		v0 = t10 + v3;
-		v3 = t10 - v3;
-		v1 = t11 + t12;
-		v2 = t12 - t11;
 
-		v4 = src[8 * 7];	/* Get odd elements */
-		v5 = src[8 * 1];
-		v6 = src[8 * 5];
-		v7 = src[8 * 3];
 
-		t10 = v5 - v4;		/* Process the odd elements */
-		t11 = v5 + v4;
-		t12 = v6 - v7;
-		v7 += v6;
-		v5 = (t11 - v7) * M13 >> 12;
-		v7 += t11;
-		t13 = (t10 + t12) * M5 >> 12;
-		v4 = t13 - (t10 * M2 >> 12);
-		v6 = t13 - (t12 * M4 >> 12) - v7;
-		v5 -= v6;
-		v4 -= v5;
 
-		src[8 * 0] = v0 + v7;	/* Write-back transformed values */
-		src[8 * 7] = v0 - v7;
-		src[8 * 1] = v1 + v6;
-		src[8 * 6] = v1 - v6;
-		src[8 * 2] = v2 + v5;
-		src[8 * 5] = v2 - v5;
-		src[8 * 3] = v3 + v4;
-		src[8 * 4] = v3 - v4;
+/*-----------------------------------------------------------------------*/
+/* Fill the bit shift register from input stream                         */
+/*-----------------------------------------------------------------------*/
+
+static int fillbits (	/* 0:OK, <0: error code */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t nbit	/* Number of bits needed at least */
+)
+{
+	int d;
+
 
-		src++;	/* Next column */
+	while (jd->dbit <= 24) {	/* Load bytes while the register has room for a byte */
+		d = getdata(jd);
+		if (d < 0) {			/* No more input data */
+			if (jd->dbit >= nbit) break;	/* Enough bits for now */
+			return d;			/* Err: read error or wrong stream termination */
+		}
+		jd->wreg |= (uint32_t)d << (24 - jd->dbit);	/* Put the byte below the remaining bits */
+		jd->dbit += 8;
 	}
 
-	/* Process rows */
-	src -= 8;
-	for (i = 0; i < 8; i++) {
-		v0 = src[0] + (128L << 8);	/* Get even elements (remove DC offset (-128) here) */
-		v1 = src[2];
-		v2 = src[4];
-		v3 = src[6];
+	return 0;
+}
 
-		t10 = v0 + v2;				/* Process the even elements */
-		t12 = v0 - v2;
-		t11 = (v1 - v3) * M13 >> 12;
-		v3 += v1;
-		t11 -= v3;
-		v0 = t10 + v3;
-		v3 = t10 - v3;
-		v1 = t11 + t12;
-		v2 = t12 - t11;
 
-		v4 = src[7];				/* Get odd elements */
-		v5 = src[1];
-		v6 = src[5];
-		v7 = src[3];
 
-		t10 = v5 - v4;				/* Process the odd elements */
-		t11 = v5 + v4;
-		t12 = v6 - v7;
-		v7 += v6;
-		v5 = (t11 - v7) * M13 >> 12;
-		v7 += t11;
-		t13 = (t10 + t12) * M5 >> 12;
-		v4 = t13 - (t10 * M2 >> 12);
-		v6 = t13 - (t12 * M4 >> 12) - v7;
-		v5 -= v6;
-		v4 -= v5;
 
-		dst[0] = BYTECLIP((v0 + v7) >> 8);	/* Descale the transformed values 8 bits and output */
-		dst[7] = BYTECLIP((v0 - v7) >> 8);
-		dst[1] = BYTECLIP((v1 + v6) >> 8);
-		dst[6] = BYTECLIP((v1 - v6) >> 8);
-		dst[2] = BYTECLIP((v2 + v5) >> 8);
-		dst[5] = BYTECLIP((v2 - v5) >> 8);
-		dst[3] = BYTECLIP((v3 + v4) >> 8);
-		dst[4] = BYTECLIP((v3 - v4) >> 8);
-		dst += 8;
+/*-----------------------------------------------------------------------*/
+/* Extract N bits from input stream                                      */
+/*-----------------------------------------------------------------------*/
+
+static int bitext (	/* >=0: extracted data, <0: error code */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	int nbit		/* Number of bits to extract (1 to 16) */
+)
+{
+	int v;
 
-		src += 8;	/* Next row */
+
+	if (jd->dbit < nbit) {
+		v = fillbits(jd, (uint16_t)nbit);
+		if (v) return v;	/* Err: input */
 	}
+	v = (int)(jd->wreg >> (32 - nbit));	/* Get the bits from MSB of the register */
+	jd->wreg <<= nbit;
+	jd->dbit -= nbit;
+
+	return v;
 }
 
 
 
 
 /*-----------------------------------------------------------------------*/
-/* Load all blocks in the MCU into working buffer                        */
+/* Extract a huffman decoded data from input stream                      */
 /*-----------------------------------------------------------------------*/
 
-static JRESULT mcu_load (
-	JDEC* jd		/* Pointer to the decompressor object */
+static int huffext (	/* >=0: decoded data, <0: error code */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t id,	/* Huffman table ID (0 to 3) */
+	uint16_t cls	/* Class of the table (0:DC, 1:AC) */
 )
 {
-	int32_t *tmp = (int32_t*)jd->workbuf;	/* Block working buffer for de-quantize and IDCT */
-	int b, d, e;
-	uint16_t blk, nby, nbc, i, z, id, cmp;
-	uint8_t *bp;
-	const uint8_t *hb, *hd;
-	const uint16_t *hc;
-	const int32_t *dqf;
+	const uint8_t *hbits, *hdata;
+	const uint16_t *hcode;
+	uint32_t w;
+	uint16_t bl, nd, v;
+	int d;
 
 
-	nby = jd->msx * jd->msy;	/* Number of Y blocks (1, 2 or 4) */
-	nbc = 2;					/* Number of C blocks (2) */
-	bp = jd->mcubuf;			/* Pointer to the first block */
+	if (jd->dbit < 16) {
+		d = fillbits(jd, 1);
+		if (d) return d;	/* Err: input */
+	}
+	w = jd->wreg;
+
+#if JD_FASTDECODE
+	/* Look up the code in the table (codes up to HUFF_BIT bits) */
+	if (cls) {
+		v = ((const uint16_t*)jd->hufflut[id][1])[w >> (32 - HUFF_BIT)];
+		bl = v >> 8; v &= 0xFF;
+	} else {
+		v = ((const uint8_t*)jd->hufflut[id][0])[w >> (32 - HUFF_BIT)];
+		bl = v >> 4; v &= 0x0F;
+	}
+	if (bl) {	/* Found? */
+		if (bl > jd->dbit) return 0 - (int)JDR_INP;	/* Err: wrong stream termination */
+		jd->wreg <<= bl;
+		jd->dbit -= bl;
+		return v;
+	}
+#endif
 
-	for (blk = 0; blk < nby + nbc; blk++) {
-		cmp = (blk < nby) ? 0 : blk - nby + 1;	/* Component number 0:Y, 1:Cb, 2:Cr */
-		id = cmp ? 1 : 0;						/* Huffman table ID of the component */
+	/* Search the code word in each bit length */
+	hbits = jd->huffbits[id][cls];
+	hcode = jd->huffcode[id][cls];
+	hdata = jd->huffdata[id][cls];
+	for (bl = 1; bl <= 16; bl++) {
+		v = (uint16_t)(w >> (32 - bl));		/* Code word of this bit length */
+		for (nd = *hbits++; nd; nd--) {
+			if (v == *hcode++) {			/* Matched? */
+				if (bl > jd->dbit) return 0 - (int)JDR_INP;	/* Err: wrong stream termination */
+				jd->wreg <<= bl;
+				jd->dbit -= bl;
+				return *hdata;				/* Return the decoded data */
+			}
+			hdata++;
+		}
+	}
 
-		/* Extract a DC element from input stream */
-		hb = jd->huffbits[id][0];				/* Huffman table for the DC element */
-		hc = jd->huffcode[id][0];
-		hd = jd->huffdata[id][0];
-		b = huffext(jd, hb, hc, hd);			/* Extract a huffman coded data (bit length) */
-		if (b < 0) return 0 - b;				/* Err: invalid code or input */
-		d = jd->dcv[cmp];						/* DC value of previous block */
+	return 0 - (int)JDR_FMT1;	/* Err: code not found (may be collapted data) */
+}
+
+
+
+
+#if JD_USE_ARITH
+/*-----------------------------------------------------------------------*/
+/* Probability estimation state machine of arithmetic decoding (Table D.2) */
+/*-----------------------------------------------------------------------*/
+/* Qe << 16 | Next_Index_MPS << 8 | Switch_MPS << 7 | Next_Index_LPS, the last one is the fixed 0.5 estimate */
+
+static const uint32_t Aritab[114] = {
+	0x5A1D0181, 0x2586020E, 0x11140310, 0x080B0412, 0x03D80514, 0x01DA0617,
+	0x00E50719, 0x006F081C, 0x0036091E, 0x001A0A21, 0x000D0B23, 0x00060C09,
+	0x00030D0A, 0x00010D0C, 0x5A7F0F8F, 0x3F251024, 0x2CF21126, 0x207C1227,
+	0x17B91328, 0x1182142A, 0x0CEF152B, 0x09A1162D, 0x072F172E, 0x055C1830,
+	0x04061931, 0x03031A33, 0x02401B34, 0x01B11C36, 0x01441D38, 0x00F51E39,
+	0x00B71F3B, 0x008A203C, 0x0068213E, 0x004E223F, 0x003B2320, 0x002C0921,
+	0x5AE125A5, 0x484C2640, 0x3A0D2741, 0x2EF12843, 0x261F2944, 0x1F332A45,
+	0x19A82B46, 0x15182C48, 0x11772D49, 0x0E742E4A, 0x0BFB2F4B, 0x09F8304D,
+	0x0861314E, 0x0706324F, 0x05CD3330, 0x04DE3432, 0x040F3532, 0x03633633,
+	0x02D43734, 0x025C3835, 0x01F83936, 0x01A43A37, 0x01603B38, 0x01253C39,
+	0x00F63D3A, 0x00CB3E3B, 0x00AB3F3D, 0x008F203D, 0x5B1241C1, 0x4D044250,
+	0x412C4351, 0x37D84452, 0x2FE84553, 0x293C4654, 0x23794756, 0x1EDF4857,
+	0x1AA94957, 0x174E4A48, 0x14244B48, 0x119C4C4A, 0x0F6B4D4A, 0x0D514E4B,
+	0x0BB64F4D, 0x0A40304D, 0x583251D0, 0x4D1C5258, 0x438E5359, 0x3BDD545A,
+	0x34EE555B, 0x2EAE565C, 0x299A575D, 0x25164756, 0x557059D8, 0x4CA95A5F,
+	0x44D95B60, 0x3E225C61, 0x38245D63, 0x32B45E63, 0x2E17565D, 0x56A860DF,
+	0x4F466165, 0x47E56266, 0x41CF6367, 0x3C3D6468, 0x375E5D63, 0x52316669,
+	0x4C0F676A, 0x4639686B, 0x415E6367, 0x56276AE9, 0x50E76B6C, 0x4B85676D,
+	0x55976D6E, 0x504F6B6F, 0x5A106FEE, 0x55226D70, 0x59EB6FF0, 0x5A1D7171
+};
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decode a binary decision from arithmetic-coded data                   */
+/*-----------------------------------------------------------------------*/
+
+static int arith_decode (	/* Decoded decision (0 or 1) */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint8_t* st		/* Statistics bin to be used and updated (MPS << 7 | state index) */
+)
+{
+	uint32_t a, c, qe, t;
+	uint8_t sv, nl, nm;
+	int ct, d;
+
+
+	a = jd->ara; c = jd->arc; ct = jd->arct;
+	while (a < 0x8000) {	/* Renormalization and data input (D.2.6) */
+		if (--ct < 0) {		/* Need a byte? */
+			d = getdata(jd);
+			if (d < 0) {	/* Input error is reported after the block (0xFF cannot be a marker) */
+				jd->marker = 0xFF;
+				d = 0;
+			}
+			c = c << 8 | d;	/* Put the byte into the code register */
+			ct += 8;
+			if (ct < 0 && ++ct == 0) a = 0x8000;	/* Got two initial bytes */
+		}
+		a <<= 1;
+	}
+
+	sv = *st;
+	qe = Aritab[sv & 0x7F];
+	nl = (uint8_t)qe;			/* Next_Index_LPS + Switch_MPS */
+	nm = (uint8_t)(qe >> 8);	/* Next_Index_MPS */
+	qe >>= 16;					/* Qe_Value */
+
+	a -= qe;					/* Decoding and estimation (D.2.4 and D.2.5) */
+	t = a << ct;
+	if (c >= t) {
+		c -= t;
+		if (a < qe) {			/* Conditional exchange */
+			*st = (sv & 0x80) ^ nm;
+		} else {
+			*st = (sv & 0x80) ^ nl;
+			sv ^= 0x80;
+		}
+		a = qe;
+	} else if (a < 0x8000) {
+		if (a < qe) {			/* Conditional exchange */
+			*st = (sv & 0x80) ^ nl;
+			sv ^= 0x80;
+		} else {
+			*st = (sv & 0x80) ^ nm;
+		}
+	}
+	jd->ara = a; jd->arc = c; jd->arct = (int8_t)ct;
+
+	return sv >> 7;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load arithmetic coding conditioning tables (DAC segment)              */
+/*-----------------------------------------------------------------------*/
+
+static int create_arith_cond (	/* 0:OK, !0:Failed */
+	JDEC* jd,				/* Pointer to the decompressor object */
+	const uint8_t* data,	/* Pointer to the conditioning table entries */
+	uint16_t ndata			/* Size of input data */
+)
+{
+	uint8_t d, v;
+
+
+	while (ndata) {	/* Process all entries in the segment */
+		if (ndata < 2) return JDR_FMT1;	/* Err: wrong data size */
+		ndata -= 2;
+		d = *data++;					/* Get table class and number */
+		v = *data++;					/* Get conditioning value */
+		if (d & 0xEC) return JDR_FMT1;	/* Err: invalid class/number */
+		if (d >> 4) {					/* AC: Kx */
+			if (v < 1 || v > 63) return JDR_FMT1;
+		} else {						/* DC: U << 4 | L */
+			if ((v & 15) > (v >> 4)) return JDR_FMT1;
+		}
+		jd->arcond[d & 3][d >> 4] = v;
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Allocate statistics areas of the arithmetic decoding for a scan       */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT arith_alloc (
+	JDEC* jd		/* Pointer to the decompressor object */
+)
+{
+	uint16_t i, id, cls;
+
+
+	for (i = 0; i < jd->nscomp; i++) {
+		for (cls = 0; cls < 2; cls++) {
+			id = cls ? jd->shtid[i] & 15 : jd->shtid[i] >> 4;
+			if (!jd->arstat[id][cls]) {	/* 64 bins for DC and 256 bins for AC statistics */
+				jd->arstat[id][cls] = alloc_pool(jd, cls ? 256 : 64);
+				if (!jd->arstat[id][cls]) return JDR_MEM1;	/* Err: not enough memory */
+			}
+		}
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Initialize arithmetic decoder at start of scan or restart interval    */
+/*-----------------------------------------------------------------------*/
+
+static void arith_reset (
+	JDEC* jd		/* Pointer to the decompressor object */
+)
+{
+	uint16_t i, n;
+	uint8_t *st;
+
+
+	for (i = 0; i < jd->nscomp; i++) {
+		if (!jd->progressive || (jd->ss == 0 && jd->ah == 0)) {	/* Scan with DC differences */
+			st = jd->arstat[jd->shtid[i] >> 4][0];
+			for (n = 0; n < 64; st[n++] = 0) ;
+			jd->arctx[jd->scomp[i]] = 0;
+		}
+		if (!jd->progressive || jd->ss) {	/* Scan with AC elements */
+			st = jd->arstat[jd->shtid[i] & 15][1];
+			for (n = 0; n < 256; st[n++] = 0) ;
+		}
+	}
+	jd->arfix = 113;	/* Fixed probability bin */
+	jd->arc = jd->ara = 0; jd->arct = -16;	/* Load two bytes at first decision */
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decode a DC difference from arithmetic-coded data                     */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT arith_dc (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t cmp,	/* Component number */
+	uint16_t id		/* Conditioning table ID */
+)
+{
+	uint8_t *st, *sb = jd->arstat[id][0];
+	int m, v, s;
+
+
+	st = sb + jd->arctx[cmp];	/* S0 of the context */
+	if (!arith_decode(jd, st)) {	/* Zero difference */
+		jd->arctx[cmp] = 0;
+		return JDR_OK;
+	}
+	s = arith_decode(jd, st + 1);	/* Sign */
+	st += 2 + s;					/* SP or SN */
+	m = arith_decode(jd, st);		/* Magnitude category */
+	if (m) {
+		st = sb + 20;				/* X1 */
+		while (arith_decode(jd, st)) {
+			if ((m <<= 1) == 0x8000) return JDR_FMT1;	/* Err: magnitude overflow */
+			st++;
+		}
+	}
+	v = jd->arcond[id][0];			/* Conditioning category for the next block (F.1.4.4.1.2) */
+	if (m < (1 << (v & 15)) >> 1) {
+		jd->arctx[cmp] = 0;
+	} else if (m > (1 << (v >> 4)) >> 1) {
+		jd->arctx[cmp] = (uint8_t)(12 + s * 4);
+	} else {
+		jd->arctx[cmp] = (uint8_t)(4 + s * 4);
+	}
+	v = m;
+	st += 14;						/* Magnitude bits */
+	while (m >>= 1) {
+		if (arith_decode(jd, st)) v |= m;
+	}
+	v += 1;
+	if (s) v = -v;
+	jd->dcv[cmp] = (int16_t)(jd->dcv[cmp] + v);	/* Current DC value */
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decode an AC element from arithmetic-coded data                       */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT arith_ac (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t id,	/* Conditioning table ID */
+	uint16_t* k,	/* Index of the element (zigzag order, moved to the non-zero element) */
+	uint16_t se,	/* End of the band */
+	int* val		/* Decoded value (0:end of block) */
+)
+{
+	uint8_t *st, *sb = jd->arstat[id][1];
+	uint16_t i = *k;
+	int m, v, s;
+
+
+	st = sb + 3 * (i - 1);
+	if (arith_decode(jd, st)) {		/* EOB */
+		*val = 0;
+		return JDR_OK;
+	}
+	while (!arith_decode(jd, st + 1)) {	/* Zero element */
+		st += 3;
+		if (++i > se) return JDR_FMT1;	/* Err: too long zero run */
+	}
+	*k = i;
+	s = arith_decode(jd, &jd->arfix);	/* Sign */
+	st += 2;
+	m = arith_decode(jd, st);		/* Magnitude category */
+	if (m && arith_decode(jd, st)) {
+		m <<= 1;
+		st = sb + (i <= jd->arcond[id][1] ? 189 : 217);	/* X2 of the lower or upper band */
+		while (arith_decode(jd, st)) {
+			if ((m <<= 1) == 0x8000) return JDR_FMT1;	/* Err: magnitude overflow */
+			st++;
+		}
+	}
+	v = m;
+	st += 14;						/* Magnitude bits */
+	while (m >>= 1) {
+		if (arith_decode(jd, st)) v |= m;
+	}
+	v += 1;
+	*val = s ? -v : v;
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load an arithmetic-coded block in the same form as mcu_load does      */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT arith_block (
+	JDEC* jd,				/* Pointer to the decompressor object */
+	int16_t* blk,			/* Coefficients of the block (raster order, NULL:only skip the block) */
+	uint16_t cmp,			/* Component number */
+	uint16_t id				/* Conditioning table IDs (DC << 4 | AC) */
+)
+{
+	uint16_t i;
+	int d;
+	JRESULT rc;
+
+
+	rc = arith_dc(jd, cmp, id >> 4);	/* DC element */
+	if (rc != JDR_OK) return rc;
+	if (blk) {
+		blk[0] = jd->dcv[cmp];
+		for (i = 1; i < 64; blk[i++] = 0) ;	/* Clear rest of elements */
+	}
+	for (i = 1; i < 64; i++) {		/* AC elements */
+		rc = arith_ac(jd, id & 15, &i, 63, &d);
+		if (rc != JDR_OK) return rc;
+		if (!d) break;				/* EOB? */
+		if (blk) blk[ZIG(i)] = (int16_t)d;
+	}
+
+	return jd->marker == 0xFF ? JDR_INP : JDR_OK;	/* Err: input terminated in the block */
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Apply Inverse-DCT in Arai Algorithm (see also aa_idct.png)            */
+/*-----------------------------------------------------------------------*/
+
+static void block_idct (
+	const int16_t* src,	/* Input block data (quantized coefficients in raster order) */
+	const int32_t* dqf,	/* De-quantizer table (pre-scaled for Arai Algorithm) */
+	int32_t* ws,		/* Work area for the intermediate values (64 elements) */
+	uint8_t* dst		/* Pointer to the destination to store the block as byte array (can overlap src) */
+)
+{
+	const int32_t M13 = (int32_t)(1.41421*4096), M2 = (int32_t)(1.08239*4096), M4 = (int32_t)(2.61313*4096), M5 = (int32_t)(1.84776*4096);
+	int32_t v0, v1, v2, v3, v4, v5, v6, v7;
+	int32_t t10, t11, t12, t13;
+	uint16_t i;
+
+	/* Process columns (de-quantize, apply scale factor of Arai algorithm and descale 8 bits on loading) */
+	for (i = 0; i < 8; i++) {
+		if (!(src[8 * 1] | src[8 * 2] | src[8 * 3] | src[8 * 4] | src[8 * 5] | src[8 * 6] | src[8 * 7])) {	/* Only DC element in the column (most columns)? */
+			v0 = src[8 * 0] * dqf[8 * 0] >> 8;
+			ws[8 * 0] = ws[8 * 1] = ws[8 * 2] = ws[8 * 3] = ws[8 * 4] = ws[8 * 5] = ws[8 * 6] = ws[8 * 7] = v0;
+			src++; dqf++; ws++;
+			continue;
+		}
+
+		v0 = src[8 * 0] * dqf[8 * 0] >> 8;	/* Get even elements */
+		v1 = src[8 * 2] * dqf[8 * 2] >> 8;
+		v2 = src[8 * 4] * dqf[8 * 4] >> 8;
+		v3 = src[8 * 6] * dqf[8 * 6] >> 8;
+
+		t10 = v0 + v2;		/* Process the even elements */
+		t12 = v0 - v2;
+		t11 = (v1 - v3) * M13 >> 12;
+		v3 += v1;
+		t11 -= v3;
+		v0 = t10 + v3;
+		v3 = t10 - v3;
+		v1 = t11 + t12;
+		v2 = t12 - t11;
+
+		v4 = src[8 * 7] * dqf[8 * 7] >> 8;	/* Get odd elements */
+		v5 = src[8 * 1] * dqf[8 * 1] >> 8;
+		v6 = src[8 * 5] * dqf[8 * 5] >> 8;
+		v7 = src[8 * 3] * dqf[8 * 3] >> 8;
+
+		t10 = v5 - v4;		/* Process the odd elements */
+		t11 = v5 + v4;
+		t12 = v6 - v7;
+		v7 += v6;
+		v5 = (t11 - v7) * M13 >> 12;
+		v7 += t11;
+		t13 = (t10 + t12) * M5 >> 12;
+		v4 = t13 - (t10 * M2 >> 12);
+		v6 = t13 - (t12 * M4 >> 12) - v7;
+		v5 -= v6;
+		v4 -= v5;
+
+		ws[8 * 0] = v0 + v7;	/* Write transformed values to the work area */
+		ws[8 * 7] = v0 - v7;
+		ws[8 * 1] = v1 + v6;
+		ws[8 * 6] = v1 - v6;
+		ws[8 * 2] = v2 + v5;
+		ws[8 * 5] = v2 - v5;
+		ws[8 * 3] = v3 + v4;
+		ws[8 * 4] = v3 - v4;
+
+		src++; dqf++; ws++;	/* Next column */
+	}
+
+	/* Process rows */
+	ws -= 8;
+	for (i = 0; i < 8; i++) {
+		v0 = ws[0] + (128L << 8);	/* Get even elements (remove DC offset (-128) here) */
+		v1 = ws[2];
+		v2 = ws[4];
+		v3 = ws[6];
+
+		t10 = v0 + v2;				/* Process the even elements */
+		t12 = v0 - v2;
+		t11 = (v1 - v3) * M13 >> 12;
+		v3 += v1;
+		t11 -= v3;
+		v0 = t10 + v3;
+		v3 = t10 - v3;
+		v1 = t11 + t12;
+		v2 = t12 - t11;
+
+		v4 = ws[7];					/* Get odd elements */
+		v5 = ws[1];
+		v6 = ws[5];
+		v7 = ws[3];
+
+		t10 = v5 - v4;				/* Process the odd elements */
+		t11 = v5 + v4;
+		t12 = v6 - v7;
+		v7 += v6;
+		v5 = (t11 - v7) * M13 >> 12;
+		v7 += t11;
+		t13 = (t10 + t12) * M5 >> 12;
+		v4 = t13 - (t10 * M2 >> 12);
+		v6 = t13 - (t12 * M4 >> 12) - v7;
+		v5 -= v6;
+		v4 -= v5;
+
+		dst[0] = BYTECLIP((v0 + v7) >> 8);	/* Descale the transformed values 8 bits and output */
+		dst[7] = BYTECLIP((v0 - v7) >> 8);
+		dst[1] = BYTECLIP((v1 + v6) >> 8);
+		dst[6] = BYTECLIP((v1 - v6) >> 8);
+		dst[2] = BYTECLIP((v2 + v5) >> 8);
+		dst[5] = BYTECLIP((v2 - v5) >> 8);
+		dst[3] = BYTECLIP((v3 + v4) >> 8);
+		dst[4] = BYTECLIP((v3 - v4) >> 8);
+		dst += 8;
+
+		ws += 8;	/* Next row */
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load all blocks in the MCU into working buffer                        */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT mcu_load (
+	JDEC* jd		/* Pointer to the decompressor object */
+)
+{
+	int32_t *ws = (int32_t*)jd->workbuf;	/* Work area of IDCT */
+	int16_t *cf;	/* Coefficients of the block (loaded in place of the block and the next one in the MCU buffer) */
+	int b, d, e;
+	uint16_t blk, nb, i, z, id, cmp;
+	uint8_t *bp;
+	const int32_t *dqf;
+
+
+	nb = jd->hs[0] * jd->vs[0];	/* Number of blocks up to the current component */
+	cmp = 0;					/* Component number 0:Y, 1:Cb, 2:Cr */
+	bp = jd->mcubuf;			/* Pointer to the first block */
+
+	for (blk = 0; blk < jd->nblk; blk++) {
+		if (blk == nb) {						/* Next component? */
+			cmp++;
+			nb += jd->hs[cmp] * jd->vs[cmp];
+		}
+		id = jd->shtid[cmp];					/* Huffman table IDs of the component (DC << 4 | AC) */
+
+#if JD_USE_ARITH
+		if (jd->arith) {						/* Arithmetic-coded block */
+			cf = (cmp && jd->format >= JD_FMT_GRAY8 && jd->ncomp == 3) ? 0 : (int16_t*)bp;	/* Chroma is only skipped for grayscale output */
+			b = arith_block(jd, cf, cmp, id);
+			if (b != JDR_OK) return (JRESULT)b;
+			if (cf) {
+				dqf = jd->qttbl[jd->qtid[cmp]];
+				if (JD_USE_SCALE && jd->scale == 3) {
+					*bp = (uint8_t)((cf[0] * dqf[0] >> 8) / 256 + 128);	/* If scale ratio is 1/8, IDCT can be ommited and only DC element is used */
+				} else {
+					block_idct(cf, dqf, ws, bp);	/* Apply IDCT and store the block to the MCU buffer */
+				}
+			}
+			bp += 64;
+			continue;
+		}
+#endif
+
+		if (cmp && jd->format >= JD_FMT_GRAY8 && jd->ncomp == 3) {	/* Chroma is not used for grayscale output: */
+			b = huffext(jd, id >> 4, 0);			/* only skip the block in the input stream */
+			if (b < 0) return 0 - b;				/* without de-quantization and IDCT */
+			if (b && (e = bitext(jd, b)) < 0) return 0 - e;
+			for (i = 1; i < 64; i++) {				/* AC elements */
+				b = huffext(jd, id & 15, 1);
+				if (b == 0) break;					/* EOB? */
+				if (b < 0) return 0 - b;
+				i += (uint16_t)b >> 4;				/* Skip zero elements */
+				if (i >= 64) return JDR_FMT1;		/* Too long zero run */
+				if ((b &= 0x0F) && (e = bitext(jd, b)) < 0) return 0 - e;
+			}
+			bp += 64;
+			continue;
+		}
+
+		/* Extract a DC element from input stream */
+		b = huffext(jd, id >> 4, 0);			/* Extract a huffman coded data (bit length) */
+		if (b < 0) return 0 - b;				/* Err: invalid code or input */
+		d = jd->dcv[cmp];						/* DC value of previous block */
 		if (b) {								/* If there is any difference from previous block */
 			e = bitext(jd, b);					/* Extract data bits */
 			if (e < 0) return 0 - e;			/* Err: input */
@@ -499,17 +1563,15 @@ static JRESULT mcu_load (
 			d += e;								/* Get current value */
 			jd->dcv[cmp] = (int16_t)d;			/* Save current DC value for next block */
 		}
-		dqf = jd->qttbl[jd->qtid[cmp]];			/* De-quantizer table ID for this component */
-		tmp[0] = d * dqf[0] >> 8;				/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+		cf = (int16_t*)bp;						/* Coefficients are de-quantized in IDCT */
+		cf[0] = (int16_t)d;
 
 		/* Extract following 63 AC elements from input stream */
-		for (i = 1; i < 64; tmp[i++] = 0) ;		/* Clear rest of elements */
-		hb = jd->huffbits[id][1];				/* Huffman table for the AC elements */
-		hc = jd->huffcode[id][1];
-		hd = jd->huffdata[id][1];
+		for (i = 1; i < 64; cf[i++] = 0) ;		/* Clear rest of elements */
+		id &= 15;								/* Huffman table for the AC elements */
 		i = 1;					/* Top of the AC elements */
 		do {
-			b = huffext(jd, hb, hc, hd);		/* Extract a huffman coded value (zero runs and bit length) */
+			b = huffext(jd, id, 1);				/* Extract a huffman coded value (zero runs and bit length) */
 			if (b == 0) break;					/* EOB? */
 			if (b < 0) return 0 - b;			/* Err: invalid code or input error */
 			z = (uint16_t)b >> 4;				/* Number of leading zero elements */
@@ -523,14 +1585,15 @@ static JRESULT mcu_load (
 				b = 1 << (b - 1);				/* MSB position */
 				if (!(d & b)) d -= (b << 1) - 1;/* Restore negative value if needed */
 				z = ZIG(i);						/* Zigzag-order to raster-order converted index */
-				tmp[z] = d * dqf[z] >> 8;		/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+				cf[z] = (int16_t)d;
 			}
 		} while (++i < 64);		/* Next AC element */
 
+		dqf = jd->qttbl[jd->qtid[cmp]];			/* De-quantizer table ID for this component */
 		if (JD_USE_SCALE && jd->scale == 3) {
-			*bp = (uint8_t)((*tmp / 256) + 128);	/* If scale ratio is 1/8, IDCT can be ommited and only DC element is used */
+			*bp = (uint8_t)((cf[0] * dqf[0] >> 8) / 256 + 128);	/* If scale ratio is 1/8, IDCT can be ommited and only DC element is used */
 		} else {
-			block_idct(tmp, bp);		/* Apply IDCT and store the block to the MCU buffer */
+			block_idct(cf, dqf, ws, bp);	/* Apply IDCT and store the block to the MCU buffer */
 		}
 
 		bp += 64;				/* Next block */
@@ -543,7 +1606,685 @@ static JRESULT mcu_load (
 
 
 /*-----------------------------------------------------------------------*/
-/* Output an MCU: Convert YCrCb to RGB and output it in RGB form         */
+/* Convert RGB888 pixels into the output pixel format                    */
+/*-----------------------------------------------------------------------*/
+
+static void pack_pixels (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	const uint8_t* s,	/* RGB888 or luma pixels to convert */
+	void* dst,			/* Output buffer (can be the same as s, or in front of s by the number of pixels for 32-bit formats) */
+	const JRECT* rect,	/* Rectangular area of the pixels in the output image */
+	uint16_t skip,		/* Number of source pixels to skip at end of each line */
+	uint8_t ns			/* Size of a source pixel (1:luma, 3:RGB888) */
+)
+{
+	uint16_t x, y, w, h;
+	uint8_t o1, o2;
+
+
+	w = rect->right - rect->left + 1; h = rect->bottom - rect->top + 1;
+	o1 = ns >> 1; o2 = o1 * 2;	/* Offset of G and B in a source pixel (luma is used for all of R, G and B) */
+	skip *= ns;
+
+	/* Each format has its own loop to keep the format check out of the pixel loop */
+	switch (jd->format) {
+	case JD_FMT_RGB565:
+	case JD_FMT_RGB565_SWAP:
+		{
+			const uint8_t *dm;
+			uint16_t w16, *d = (uint16_t*)dst;
+			uint8_t t, sw = (jd->format == JD_FMT_RGB565_SWAP) ? 8 : 0;
+
+			if (jd->dither) {	/* Ordered dithering on the absolute pixel position */
+				for (y = 0; y < h; y++) {
+					dm = Bayer4[(rect->top + y) & 3];	/* Threshold map of this line */
+					for (x = 0; x < w; x++) {
+						t = dm[(rect->left + x) & 3];
+						w16 = (BYTECLIP(s[0] + (t >> 1)) & 0xF8) << 8;	/* RRRRR----------- */
+						w16 |= (BYTECLIP(s[o1] + (t >> 2)) & 0xFC) << 3;	/* -----GGGGGG----- */
+						w16 |= BYTECLIP(s[o2] + (t >> 1)) >> 3;			/* -----------BBBBB */
+						*d++ = (uint16_t)(w16 << sw | w16 >> sw);		/* Swap bytes if needed */
+						s += ns;
+					}
+					s += skip;	/* Skip truncated pixels */
+				}
+			} else if (sw) {
+				for (y = 0; y < h; y++) {
+					for (x = 0; x < w; x++) {
+						w16 = (s[0] & 0xF8) << 8;		/* RRRRR----------- */
+						w16 |= (s[o1] & 0xFC) << 3;		/* -----GGGGGG----- */
+						w16 |= s[o2] >> 3;				/* -----------BBBBB */
+						*d++ = (uint16_t)(w16 << 8 | w16 >> 8);	/* GGGBBBBBRRRRRGGG */
+						s += ns;
+					}
+					s += skip;	/* Skip truncated pixels */
+				}
+			} else {
+				for (y = 0; y < h; y++) {
+					for (x = 0; x < w; x++) {
+						w16 = (s[0] & 0xF8) << 8;		/* RRRRR----------- */
+						w16 |= (s[o1] & 0xFC) << 3;		/* -----GGGGGG----- */
+						w16 |= s[o2] >> 3;				/* -----------BBBBB */
+						*d++ = w16;
+						s += ns;
+					}
+					s += skip;	/* Skip truncated pixels */
+				}
+			}
+		}
+		break;
+
+	case JD_FMT_ARGB8888:
+		{
+			uint32_t *d = (uint32_t*)dst;	/* Output is aligned to the word boundary */
+
+			for (y = 0; y < h; y++) {
+				for (x = 0; x < w; x++) {
+					*d++ = 0xFF000000 | (uint32_t)s[0] << 16 | (uint32_t)s[o1] << 8 | s[o2];	/* AAAAAAAARRRRRRRRGGGGGGGGBBBBBBBB */
+					s += ns;
+				}
+				s += skip;	/* Skip truncated pixels */
+			}
+		}
+		break;
+
+	case JD_FMT_GRAY8:	/* Luma source only */
+		{
+			uint8_t *d = (uint8_t*)dst;
+
+			if (d == s && !skip) break;	/* Already in place */
+			for (y = 0; y < h; y++) {
+				for (x = 0; x < w; x++) *d++ = *s++;
+				s += skip;	/* Skip truncated pixels */
+			}
+		}
+		break;
+
+	case JD_FMT_GRAY4:	/* Luma source only */
+		{
+			const uint8_t *dm;
+			uint8_t *d = (uint8_t*)dst, v, t[4];
+
+			for (y = 0; y < h; y++) {
+				dm = Bayer4[(rect->top + y) & 3];	/* Threshold map of this line */
+				for (x = 0; x < 4; x++) {
+					t[x] = jd->dither ? (uint8_t)(dm[(rect->left + x) & 3] * 16 + 8) : 128;	/* Dithering or rounding offset */
+				}
+				for (x = 0; x < w; x++) {
+					v = (uint8_t)(((uint16_t)*s++ * 15 + t[x & 3] + 1) * 257 >> 16);	/* Level = (L * 15 + offset) / 255 */
+					if (x & 1) {
+						*d++ |= v;					/* ----LLLL */
+					} else {
+						*d = (uint8_t)(v << 4);		/* LLLL---- */
+					}
+				}
+				if (w & 1) d++;		/* Each line starts at byte boundary */
+				s += skip;			/* Skip truncated pixels */
+			}
+		}
+		break;
+
+	case JD_FMT_MONO1:	/* Luma source only */
+		{
+			const uint8_t *dm;
+			uint8_t *d = (uint8_t*)dst, v, b, t[4];
+
+			for (y = 0; y < h; y++) {
+				dm = Bayer4[(rect->top + y) & 3];	/* Threshold map of this line */
+				for (x = 0; x < 4; x++) {
+					t[x] = jd->dither ? (uint8_t)(dm[(rect->left + x) & 3] * 16 + 8) : 128;	/* Dithering or fixed threshold */
+				}
+				v = 0; b = 0x80;
+				for (x = 0; x < w; x++) {
+					if (*s++ >= t[x & 3]) v |= b;
+					b >>= 1;
+					if (!b) {
+						*d++ = v;
+						v = 0; b = 0x80;
+					}
+				}
+				if (b != 0x80) *d++ = v;	/* Each line starts at byte boundary */
+				s += skip;	/* Skip truncated pixels */
+			}
+		}
+		break;
+
+	default:	/* JD_FMT_RGB888 */
+		{
+			uint8_t *d = (uint8_t*)dst;
+
+			if (d == s && !skip && ns == 3) break;	/* Already in place */
+			for (y = 0; y < h; y++) {
+				for (x = 0; x < w; x++) {
+					*d++ = s[0];
+					*d++ = s[o1];
+					*d++ = s[o2];
+					s += ns;
+				}
+				s += skip;	/* Skip truncated pixels */
+			}
+		}
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the output transform of the orientation and display rotation      */
+/*-----------------------------------------------------------------------*/
+
+static uint8_t out_xform (	/* Transform (bit0:mirror horizontally, bit1:mirror vertically, bit2:then transpose) */
+	JDEC* jd		/* Pointer to the decompressor object (orient and rotate have been validated) */
+)
+{
+	uint8_t a, b;
+
+
+	a = Orient[jd->orient];		/* EXIF orientation is applied first */
+	b = Rotate[jd->rotate];		/* and the display rotation on the oriented image */
+	if (a & 4) {				/* Mirroring after transposing is mirroring the other axis before it */
+		b = (uint8_t)((b & 4) | (b & 1) << 1 | (b & 2) >> 1);
+	}
+
+	return a ^ b;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Orient a rectangular area into the output image                       */
+/*-----------------------------------------------------------------------*/
+
+static void xform_rect (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	JRECT* rect			/* Rectangular area in the output image before orienting */
+)
+{
+	uint16_t ow, oh, t;
+
+
+	if (jd->rsbuf) {	/* Size of the output image before orienting */
+		ow = jd->dw; oh = jd->dh;
+	} else {
+		ow = jd->width >> jd->scale; oh = jd->height >> jd->scale;
+	}
+	if (jd->oxf & 1) {	/* Mirror horizontally */
+		t = rect->left; rect->left = ow - 1 - rect->right; rect->right = ow - 1 - t;
+	}
+	if (jd->oxf & 2) {	/* Mirror vertically */
+		t = rect->top; rect->top = oh - 1 - rect->bottom; rect->bottom = oh - 1 - t;
+	}
+	if (jd->oxf & 4) {	/* Transpose */
+		t = rect->left; rect->left = rect->top; rect->top = t;
+		t = rect->right; rect->right = rect->bottom; rect->bottom = t;
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write pixels into the output buffer of the caller                     */
+/*-----------------------------------------------------------------------*/
+
+static void put_pixels (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	uint8_t* s,			/* RGB888 or luma pixels to write (lines of the sub-byte formats can be packed in place) */
+	const JRECT* rect,	/* Rectangular area of the pixels in the output image */
+	uint16_t skip,		/* Number of source pixels to skip at end of each line */
+	uint8_t ns			/* Size of a source pixel (1:luma, 3:RGB888) */
+)
+{
+	JRECT line;
+	uint32_t bit, i, n;
+	uint16_t w, y, ln;
+	uint8_t *d, nb, m;
+
+
+	w = rect->right - rect->left + 1;
+	nb = Fmtbit[jd->format];		/* Bits per output pixel */
+	line.left = rect->left; line.right = rect->right;
+
+	for (y = rect->top; y <= rect->bottom; y++) {
+		ln = jd->olines ? y % jd->olines : y;	/* Line in the output buffer */
+		d = jd->obuf + ln * jd->ostride;
+		bit = (uint32_t)rect->left * nb;		/* Bit position of the left pixel in the line */
+		n = (uint32_t)w * nb;					/* Bits in the line */
+		line.top = line.bottom = y;
+		if ((bit | n) & 7) {	/* Sub-byte pixels not filling whole bytes are packed in place and merged bit by bit */
+			pack_pixels(jd, s, s, &line, 0, ns);
+			for (i = 0; i < n; i++, bit++) {
+				m = 0x80 >> (bit & 7);
+				if (s[i / 8] & 0x80 >> (i & 7)) {
+					d[bit / 8] |= m;
+				} else {
+					d[bit / 8] &= ~m;
+				}
+			}
+		} else {				/* Converted directly into the output buffer */
+			pack_pixels(jd, s, d + bit / 8, &line, 0, ns);
+		}
+		s += (w + skip) * ns;	/* Next line (truncated pixels are skipped) */
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Orient a rectangular of pixels and output it                          */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT rect_output (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	uint16_t (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint8_t* s,			/* RGB888 or luma pixels to output (can be reordered in place) */
+	void* dst,			/* Output buffer (see pack_pixels, not used when writing into the output buffer of the caller) */
+	JRECT* rect,		/* Rectangular area of the pixels in the output image before orienting */
+	uint16_t skip,		/* Number of source pixels to skip at end of each line */
+	uint8_t ns			/* Size of a source pixel (1:luma, 3:RGB888) */
+)
+{
+	uint16_t w, h, x, y, t;
+	int16_t sx, sy;
+	uint8_t *d, *p, i;
+
+
+	if (jd->oxf) {	/* Transform the rectangular */
+		w = rect->right - rect->left + 1; h = rect->bottom - rect->top + 1;
+
+		if (h == 1) {		/* A line only needs to be reversed in place for mirroring (a transposed line is a column) */
+			skip = 0;		/* No following line to skip to */
+			if (jd->oxf & 1) {
+				d = s; p = s + (w - 1) * ns;
+				for ( ; d < p; p -= ns * 2) {
+					for (i = 0; i < ns; i++) {
+						t = *d; *d++ = *p; *p++ = (uint8_t)t;
+					}
+				}
+			}
+		} else {			/* Reorder the pixels into the tile buffer */
+			if (jd->oxf & 4) {	/* Steps of the destination for the next source pixel and line */
+				sx = h; sy = 1;
+			} else {
+				sx = 1; sy = w;
+			}
+			d = jd->otbuf;
+			if (jd->oxf & 1) {
+				d += (w - 1) * sx * ns; sx = -sx;
+			}
+			if (jd->oxf & 2) {
+				d += (h - 1) * sy * ns; sy = -sy;
+			}
+			for (y = 0; y < h; y++) {
+				p = d;
+				for (x = 0; x < w; x++) {
+					for (i = 0; i < ns; i++) p[i] = *s++;
+					p += sx * ns;
+				}
+				d += sy * ns;
+				s += skip * ns;		/* Skip truncated pixels */
+			}
+			s = jd->otbuf; skip = 0;
+		}
+		xform_rect(jd, rect);
+	}
+
+	if (jd->ostride) {	/* Convert the pixels into the output buffer and tell it to the output function if given */
+		put_pixels(jd, s, rect, skip, ns);
+		return (!outfunc || outfunc(jd, 0, rect)) ? JDR_OK : JDR_INTR;
+	}
+
+	/* Convert the pixels into the output pixel format and output them */
+	pack_pixels(jd, s, dst, rect, skip, ns);
+	return outfunc(jd, dst, rect) ? JDR_OK : JDR_INTR;
+}
+
+
+
+
+#if JD_USE_RESIZE
+/*-----------------------------------------------------------------------*/
+/* Resize an MCU row with area averaging and output it line by line      */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT resize_band (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint16_t y,		/* Top of the band in the descaled image */
+	uint16_t ry		/* Height of the band */
+)
+{
+	uint16_t sw, sh, iy, ix, x0, x1;
+	uint32_t r, g, b, n, *acc;
+	uint8_t *sp;
+	JRECT rect;
+	JRESULT rc;
+
+
+	sw = jd->width >> jd->scale; sh = jd->height >> jd->scale;	/* Size of the descaled image */
+
+	for (iy = 0; iy < ry; iy++) {
+		/* Reduce a line horizontally and accumulate it into the output line */
+		sp = jd->rsbuf + iy * sw * 3;
+		acc = jd->rsacc;
+		x0 = 0;
+		for (ix = 0; ix < jd->dw; ix++) {
+			x1 = jd->rsmap[ix + 1];		/* Source columns of this output pixel are x0..x1-1 */
+			r = g = b = 0;
+			do {
+				r += *sp++;
+				g += *sp++;
+				b += *sp++;
+			} while (++x0 < x1);
+			*acc++ += r; *acc++ += g; *acc++ += b;
+		}
+		jd->rsn++;
+
+		/* Put the averaged output line if this is the last source line of it */
+		if ((uint32_t)(y + iy + 1) * jd->dh >= (uint32_t)(jd->rsy + 1) * sh) {
+			uint8_t *op = jd->rsbuf + iy * sw * 3;	/* Build the output line over the consumed source line */
+
+			acc = jd->rsacc;
+			x0 = 0;
+			for (ix = 0; ix < jd->dw; ix++) {
+				x1 = jd->rsmap[ix + 1];
+				n = (uint32_t)(x1 - x0) * jd->rsn;	/* Number of source pixels averaged */
+				r = (acc[0] + n / 2) / n;
+				g = (acc[1] + n / 2) / n;
+				b = (acc[2] + n / 2) / n;
+				acc[0] = acc[1] = acc[2] = 0;
+				acc += 3;
+				x0 = x1;
+				if (jd->format >= JD_FMT_GRAY8) {	/* Grayscale formats take a luma line */
+					*op++ = (uint8_t)((r * 77 + g * 150 + b * 29) >> 8);	/* Y = 0.299R + 0.587G + 0.114B */
+				} else {
+					*op++ = (uint8_t)r; *op++ = (uint8_t)g; *op++ = (uint8_t)b;
+				}
+			}
+			op = jd->rsbuf + iy * sw * 3;
+			rect.left = 0; rect.right = jd->dw - 1;
+			rect.top = rect.bottom = jd->rsy;
+			if (jd->format == JD_FMT_ARGB8888 && !jd->ostride) {	/* 32-bit output line does not fit in the source line */
+				uint8_t *op32 = jd->rsbuf + ((sw * (jd->msy * 8 >> jd->scale) * 3 + 3) & ~3);	/* Line buffer behind the band */
+
+				rc = rect_output(jd, outfunc, op, op32, &rect, 0, 3);
+			} else {
+				rc = rect_output(jd, outfunc, op, op, &rect, 0, (jd->format >= JD_FMT_GRAY8) ? 1 : 3);
+			}
+			if (rc != JDR_OK) return rc;
+			jd->rsy++; jd->rsn = 0;
+		}
+	}
+
+	return JDR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get a component sample at a pixel position in the MCU                 */
+/*-----------------------------------------------------------------------*/
+
+static const uint8_t* mcu_sample (	/* Pointer to the sample in the MCU buffer */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t cmp,	/* Component number */
+	uint16_t x,		/* Pixel position in the MCU */
+	uint16_t y
+)
+{
+	const uint8_t *p = jd->mcubuf;
+	uint16_t i;
+
+
+	for (i = 0; i < cmp; i++) p += jd->hs[i] * jd->vs[i] * 64;	/* Top of the component */
+	x = x * jd->hs[cmp] / jd->msx;	/* Position in the subsampled component */
+	y = y * jd->vs[cmp] / jd->msy;
+
+	p += ((y >> 3) * jd->hs[cmp] + (x >> 3)) * 64;	/* Top of the block */
+	if (!JD_USE_SCALE || jd->scale != 3) p += (y & 7) * 8 + (x & 7);	/* Only DC value at top of each block for 1/8 scaling */
+
+	return p;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get an MCU kept in the context buffer for triangle filter             */
+/*-----------------------------------------------------------------------*/
+
+/* The context buffer (fcbuf) has an extended 10x10 tile for each of Cb and Cr
+/  (8x8 block with a sample around it), a 128 byte chroma line (Cb at 0, Cr at 64),
+/  the bottom row of Cb and Cr blocks of the previous MCU row and a ring of the
+/  loaded MCUs. An MCU is output after the MCU at right and the MCU below are
+/  loaded, so that the left column and the top row of the tile are taken from the
+/  previous MCU and MCU row, and the right column and the bottom row from the ring.
+/  The edge samples are repeated only at the edges of the image. */
+
+#define FC_EXT		0		/* Offset of the extended Cb and Cr tiles */
+#define FC_LINE		200		/* Offset of the upsampled chroma line */
+#define FC_ROW		328		/* Offset of the chroma row context */
+
+static uint8_t* fancy_mcu (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint32_t i		/* Index of the MCU in the image */
+)
+{
+	uint32_t nm;
+
+
+	nm = (jd->width + jd->msx * 8 - 1) / (jd->msx * 8);	/* Number of MCUs in an MCU row */
+	return jd->fcbuf + FC_ROW + nm * 16 + i % ((jd->msy - 1) * nm + jd->msx) * (jd->nblk * 64);	/* Ring of the MCUs following the row context */
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load Cb/Cr blocks of an MCU with the context for triangle filter      */
+/*-----------------------------------------------------------------------*/
+
+static void fancy_context (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint32_t i		/* Index of the MCU in the image (MCU row * MCUs in an MCU row + MCU column) */
+)
+{
+	uint16_t k, j, c, nm, nx, mcx, mcy, ofs, hr, vb;
+	uint8_t *e, *bp, *rp, *np;
+
+
+	nm = (jd->width + jd->msx * 8 - 1) / (jd->msx * 8);	/* Number of MCUs in an MCU row */
+	nx = nm * 8;									/* Width of the chroma row context */
+	mcx = (uint16_t)(i % nm); mcy = (uint16_t)(i / nm);	/* MCU column and MCU row */
+	hr = (jd->msx == 2 && mcx + 1 < nm);			/* The MCU at right is in the ring */
+	vb = (jd->msy == 2 && mcy + 1 < (jd->height + jd->msy * 8 - 1) / (jd->msy * 8));	/* The MCU below is in the ring */
+	for (c = 0; c < 2; c++) {
+		ofs = (jd->nblk - 2 + c) * 64;				/* Offset of Cb/Cr block in the MCU */
+		e = jd->fcbuf + FC_EXT + c * 100;
+		bp = fancy_mcu(jd, i) + ofs;
+		rp = jd->fcbuf + FC_ROW + c * nx + mcx * 8;	/* Bottom row of the MCU above */
+		if (mcx) {
+			for (k = 0; k < 100; k += 10) e[k] = e[k + 8];	/* Left column is the right column of the previous MCU */
+		}
+		for (k = 10; k < 90; k += 10) {
+			for (j = 0; j < 8; j++) e[k + j + 1] = *bp++;	/* Cb/Cr block */
+		}
+		if (hr) {
+			np = fancy_mcu(jd, i + 1) + ofs;
+			for (k = 10; k < 90; k += 10, np += 8) e[k + 9] = *np;	/* Right column */
+		} else {
+			for (k = 10; k < 90; k += 10) e[k + 9] = e[k + 8];	/* (repeated at right end of the image) */
+		}
+		if (mcy) {
+			for (j = 0; j < 8; j++) e[j + 1] = rp[j];	/* Top row */
+			e[9] = hr ? rp[8] : e[8];
+		} else {
+			for (j = 1; j < 10; j++) e[j] = e[10 + j];	/* (repeated at top of the image) */
+		}
+		for (j = 0; j < 8; j++) rp[j] = e[80 + j + 1];	/* Save bottom row for the next MCU row */
+		if (vb) {
+			np = fancy_mcu(jd, i + nm) + ofs;
+			for (j = 0; j < 8; j++) e[90 + j + 1] = np[j];	/* Bottom row */
+			e[99] = hr ? fancy_mcu(jd, i + nm + 1)[ofs] : e[98];
+		} else {
+			for (j = 1; j < 10; j++) e[90 + j] = e[80 + j];	/* (repeated at bottom of the image) */
+		}
+		if (!mcx) {
+			for (k = 0; k < 100; k += 10) e[k] = e[k + 1];	/* Left column (repeated at left end of the image) */
+		}
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Upsample a Cb/Cr line of an MCU with triangle filter                  */
+/*-----------------------------------------------------------------------*/
+
+static void fancy_line (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t iy		/* Line in the MCU */
+)
+{
+	uint16_t c, i, v0, v1, h0, h1, cs[10];
+	const uint8_t *e0, *e1;
+	uint8_t *d;
+
+
+	/* Weights of the nearer and the farther sample for each direction (3:1 for 2x upsampling) */
+	v0 = (jd->msy == 2) ? 3 : 4; v1 = 4 - v0;
+	h0 = (jd->msx == 2) ? 3 : 4; h1 = 4 - h0;
+
+	for (c = 0; c < 2; c++) {
+		e0 = jd->fcbuf + FC_EXT + c * 100 + (iy / jd->msy + 1) * 10;	/* Nearer chroma row */
+		e1 = e0 + ((iy & 1) ? 10 : -10);								/* Farther chroma row */
+		for (i = 0; i < 10; i++) cs[i] = e0[i] * v0 + e1[i] * v1;		/* Vertical filter */
+		d = jd->fcbuf + FC_LINE + c * 64;
+		if (jd->msx == 2) {
+			for (i = 1; i < 9; i++) {	/* Horizontal filter */
+				*d++ = (uint8_t)((cs[i] * h0 + cs[i - 1] * h1 + 8) >> 4);
+				*d++ = (uint8_t)((cs[i] * h0 + cs[i + 1] * h1 + 7) >> 4);
+			}
+		} else {
+			for (i = 1; i < 9; i++) *d++ = (uint8_t)((cs[i] * 4 + 8) >> 4);
+		}
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Descale an RGB MCU by averaging the pixels                            */
+/*-----------------------------------------------------------------------*/
+
+static void descale_rgb (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint8_t* rgb	/* RGB MCU to be descaled in place */
+)
+{
+	uint16_t ix, iy, mx, my, x, y, r, g, b, s, w, a;
+	uint8_t *rgb24, *op;
+
+
+	mx = jd->msx * 8; my = jd->msy * 8;	/* MCU size (pixel) */
+
+	/* Get averaged RGB value of each square correcponds to a pixel */
+	s = jd->scale * 2;	/* Bumber of shifts for averaging */
+	w = 1 << jd->scale;	/* Width of square */
+	a = (mx - w) * 3;	/* Bytes to skip for next line in the square */
+	op = rgb;
+	for (iy = 0; iy < my; iy += w) {
+		for (ix = 0; ix < mx; ix += w) {
+			rgb24 = rgb + (iy * mx + ix) * 3;
+			r = g = b = 0;
+			for (y = 0; y < w; y++) {	/* Accumulate RGB value in the square */
+				for (x = 0; x < w; x++) {
+					r += *rgb24++;
+					g += *rgb24++;
+					b += *rgb24++;
+				}
+				rgb24 += a;
+			}							/* Put the averaged RGB value as a pixel */
+			*op++ = (uint8_t)(r >> s);
+			*op++ = (uint8_t)(g >> s);
+			*op++ = (uint8_t)(b >> s);
+		}
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Build an RGB MCU from CMYK or YCCK components                         */
+/*-----------------------------------------------------------------------*/
+
+static void cmyk_rgb (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint8_t* rgb	/* RGB MCU to be built (1/8 size for 1/8 scaling) */
+)
+{
+	const int16_t CVACC = (sizeof (int16_t) > 2) ? 1024 : 128;
+	uint16_t ix, iy, mx, my, c, n, st, ofs[4][32];
+	int16_t yy, cb, cr;
+	uint8_t r, g, b, k, xm;
+	const uint8_t *top[4], *ln[4];
+
+
+	mx = jd->msx * 8; my = jd->msy * 8;		/* MCU size (pixel) */
+	st = (JD_USE_SCALE && jd->scale == 3) ? 8 : 1;	/* Only DC value of each block for 1/8 scaling */
+	xm = (jd->adobe == 0xFF) ? 0xFF : 0;	/* Adobe applications store the CMYK inverted */
+
+	/* Offset of the sample in each line of the component for each pixel */
+	top[0] = jd->mcubuf;
+	for (c = 0; c < 4; c++) {
+		if (c) top[c] = top[c - 1] + jd->hs[c - 1] * jd->vs[c - 1] * 64;	/* Top of the component */
+		for (ix = 0; ix < mx; ix += st) {
+			n = ix * jd->hs[c] / jd->msx;	/* Position in the subsampled component */
+			ofs[c][ix] = (n >> 3) * 64 + (st == 1 ? (n & 7) : 0);
+		}
+	}
+
+	for (iy = 0; iy < my; iy += st) {
+		for (c = 0; c < 4; c++) {	/* Line of each component */
+			n = iy * jd->vs[c] / jd->msy;
+			ln[c] = top[c] + (n >> 3) * jd->hs[c] * 64 + (st == 1 ? (n & 7) * 8 : 0);
+		}
+		for (ix = 0; ix < mx; ix += st) {
+			k = ln[3][ofs[3][ix]];
+			if (jd->adobe == 2) {	/* YCCK: YCbCr to inverted CMY */
+				yy = ln[0][ofs[0][ix]];
+				cb = ln[1][ofs[1][ix]] - 128;
+				cr = ln[2][ofs[2][ix]] - 128;
+				r = (uint8_t)~BYTECLIP(yy + ((int16_t)(1.402 * CVACC) * cr) / CVACC);
+				g = (uint8_t)~BYTECLIP(yy - ((int16_t)(0.344 * CVACC) * cb + (int16_t)(0.714 * CVACC) * cr) / CVACC);
+				b = (uint8_t)~BYTECLIP(yy + ((int16_t)(1.772 * CVACC) * cb) / CVACC);
+			} else {				/* CMYK: brightness of each ink */
+				r = ln[0][ofs[0][ix]] ^ xm;
+				g = ln[1][ofs[1][ix]] ^ xm;
+				b = ln[2][ofs[2][ix]] ^ xm;
+				k ^= xm;
+			}
+			/* Apply K to each color (x * k / 255 with rounding) */
+			n = r * k + 128; *rgb++ = (uint8_t)((n + (n >> 8)) >> 8);
+			n = g * k + 128; *rgb++ = (uint8_t)((n + (n >> 8)) >> 8);
+			n = b * k + 128; *rgb++ = (uint8_t)((n + (n >> 8)) >> 8);
+		}
+	}
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Output an MCU: Convert YCrCb to RGB and output it in RGB form         */
 /*-----------------------------------------------------------------------*/
 
 static JRESULT mcu_output (
@@ -554,9 +2295,10 @@ static JRESULT mcu_output (
 )
 {
 	const int16_t CVACC = (sizeof (int16_t) > 2) ? 1024 : 128;
-	uint16_t ix, iy, mx, my, rx, ry;
+	uint16_t ix, iy, bx, mx, my, rx, ry;
 	int16_t yy, cb, cr;
-	uint8_t *py, *pc, *rgb24;
+	uint8_t *rgb24, *rgb, ns, cx, cs;
+	const uint8_t *py, *pc;
 	JRECT rect;
 
 
@@ -571,167 +2313,934 @@ static JRESULT mcu_output (
 	rect.left = x; rect.right = x + rx - 1;				/* Rectangular area in the frame buffer */
 	rect.top = y; rect.bottom = y + ry - 1;
 
+	rgb = (uint8_t*)jd->workbuf;	/* RGB MCU is built at top of the working buffer */
+	if (jd->format == JD_FMT_ARGB8888 && !jd->ostride) rgb += mx * my;	/* or behind the first quarter of it to be expanded to 32-bit in place */
+	ns = 3;
+
+
+	if (jd->ncomp == 4) {	/* CMYK or YCCK image */
+
+		cmyk_rgb(jd, rgb);
+
+		/* Descale the MCU rectangular if needed */
+		if (JD_USE_SCALE && jd->scale && jd->scale != 3) descale_rgb(jd, rgb);
+
+		/* Convert RGB to luma for grayscale output */
+		if (jd->format >= JD_FMT_GRAY8) {
+			ns = 1;
+			rgb24 = rgb;
+			for (ix = 0; ix < (mx >> jd->scale) * (my >> jd->scale); ix++, rgb24 += 3) {
+				rgb[ix] = (uint8_t)((rgb24[0] * 77 + rgb24[1] * 150 + rgb24[2] * 29 + 128) >> 8);
+			}
+		}
+
+	} else if (jd->ncomp == 1 || jd->format >= JD_FMT_GRAY8) {	/* Grayscale image or grayscale output (only Y component is used) */
+
+		ns = 1;
+		if (jd->msx * jd->msy == 1) {	/* Single block MCU? */
+			rgb = jd->mcubuf;			/* The Y block is the luma MCU as is */
+		} else {						/* Build a luma MCU from Y blocks */
+			rgb = (uint8_t*)jd->workbuf;
+			rgb24 = rgb;
+			if (JD_USE_SCALE && jd->scale == 3) {	/* Only DC value of each block for 1/8 scaling */
+				for (iy = 0; iy < my; iy += 8) {
+					for (ix = 0; ix < mx; ix += 8) *rgb24++ = *mcu_sample(jd, 0, ix, iy);
+				}
+			} else if (jd->hs[0] == jd->msx && jd->vs[0] == jd->msy) {	/* Full size Y component */
+				for (iy = 0; iy < my; iy++) {
+					py = jd->mcubuf + (iy >> 3) * jd->msx * 64 + (iy & 7) * 8;
+					for (bx = 0; bx < jd->msx; bx++, py += 64) {
+						for (ix = 0; ix < 8; ix++) *rgb24++ = py[ix];
+					}
+				}
+			} else {					/* Subsampled Y component (upsampled by pixel replication) */
+				for (iy = 0; iy < my; iy++) {
+					for (ix = 0; ix < mx; ix++) *rgb24++ = *mcu_sample(jd, 0, ix, iy);
+				}
+			}
+		}
+
+		/* Descale the luma MCU if needed */
+		if (JD_USE_SCALE && jd->scale && jd->scale != 3) {
+			uint16_t x, y, v, s, w, a;
+			uint8_t *op;
+
+			s = jd->scale * 2;	/* Number of shifts for averaging */
+			w = 1 << jd->scale;	/* Width of square */
+			a = mx - w;			/* Bytes to skip for next line in the square */
+			op = rgb;
+			for (iy = 0; iy < my; iy += w) {
+				for (ix = 0; ix < mx; ix += w) {
+					rgb24 = rgb + iy * mx + ix;
+					v = 0;
+					for (y = 0; y < w; y++) {	/* Accumulate luma value in the square */
+						for (x = 0; x < w; x++) v += *rgb24++;
+						rgb24 += a;
+					}
+					*op++ = (uint8_t)(v >> s);	/* Put the averaged luma value as a pixel */
+				}
+			}
+		}
+
+	} else if (!JD_USE_SCALE || jd->scale != 3) {	/* Not for 1/8 scaling */
+
+		/* Build an RGB MCU from discrete comopnents */
+		rgb24 = rgb;
+		if (jd->hs[0] == jd->msx && jd->vs[0] == jd->msy && jd->nblk == jd->msx * jd->msy + 2) {	/* Full size Y and a Cb/Cr block (4:4:4, 4:2:2, 4:2:0, 4:1:1, 4:4:0...) */
+			for (iy = 0; iy < my; iy++) {
+				py = jd->mcubuf + (iy >> 3) * jd->msx * 64 + (iy & 7) * 8;	/* Y line */
+				if (jd->fcbuf) {	/* Triangle filter */
+					fancy_line(jd, iy);
+					pc = jd->fcbuf + FC_LINE;		/* Upsampled Cb line (Cr line is 64 bytes behind) */
+					cs = 1;
+				} else {			/* Pixel replication */
+					pc = jd->mcubuf + mx * my + iy / jd->msy * 8;	/* Cb line (Cr line is in the next block) */
+					cs = jd->msx;
+				}
+				cx = 0;
+				for (bx = 0; bx < jd->msx; bx++, py += 64) {	/* Each Y block in the line */
+					for (ix = 0; ix < 8; ix++) {
+						cb = pc[0] - 128; 	/* Get Cb/Cr component and restore right level */
+						cr = pc[64] - 128;
+						if (++cx == cs) {	/* Increase chroma pointer every cs pixels */
+							cx = 0; pc++;
+						}
+						yy = py[ix];		/* Get Y component */
+
+						/* Convert YCbCr to RGB */
+						*rgb24++ = /* R */ BYTECLIP(yy + ((int16_t)(1.402 * CVACC) * cr) / CVACC);
+						*rgb24++ = /* G */ BYTECLIP(yy - ((int16_t)(0.344 * CVACC) * cb + (int16_t)(0.714 * CVACC) * cr) / CVACC);
+						*rgb24++ = /* B */ BYTECLIP(yy + ((int16_t)(1.772 * CVACC) * cb) / CVACC);
+					}
+				}
+			}
+		} else {	/* Any other sampling factors (each component is upsampled by pixel replication) */
+			for (iy = 0; iy < my; iy++) {
+				for (ix = 0; ix < mx; ix++) {
+					yy = *mcu_sample(jd, 0, ix, iy);		/* Get Y component */
+					cb = *mcu_sample(jd, 1, ix, iy) - 128;	/* Get Cb/Cr component and restore right level */
+					cr = *mcu_sample(jd, 2, ix, iy) - 128;
+
+					/* Convert YCbCr to RGB */
+					*rgb24++ = /* R */ BYTECLIP(yy + ((int16_t)(1.402 * CVACC) * cr) / CVACC);
+					*rgb24++ = /* G */ BYTECLIP(yy - ((int16_t)(0.344 * CVACC) * cb + (int16_t)(0.714 * CVACC) * cr) / CVACC);
+					*rgb24++ = /* B */ BYTECLIP(yy + ((int16_t)(1.772 * CVACC) * cb) / CVACC);
+				}
+			}
+		}
+
+		/* Descale the MCU rectangular if needed */
+		if (JD_USE_SCALE && jd->scale) descale_rgb(jd, rgb);
+
+	} else {	/* For only 1/8 scaling (left-top pixel in each block are the DC value of the block) */
+
+		/* Build a 1/8 descaled RGB MCU from discrete comopnents */
+		rgb24 = rgb;
+		for (iy = 0; iy < my; iy += 8) {
+			for (ix = 0; ix < mx; ix += 8) {
+				yy = *mcu_sample(jd, 0, ix, iy);		/* Get Y component */
+				cb = *mcu_sample(jd, 1, ix, iy) - 128;	/* Get Cb/Cr component and restore right level */
+				cr = *mcu_sample(jd, 2, ix, iy) - 128;
+
+				/* Convert YCbCr to RGB */
+				*rgb24++ = /* R */ BYTECLIP(yy + ((int16_t)(1.402 * CVACC) * cr / CVACC));
+				*rgb24++ = /* G */ BYTECLIP(yy - ((int16_t)(0.344 * CVACC) * cb + (int16_t)(0.714 * CVACC) * cr) / CVACC);
+				*rgb24++ = /* B */ BYTECLIP(yy + ((int16_t)(1.772 * CVACC) * cb / CVACC));
+			}
+		}
+	}
+
+	mx >>= jd->scale;	/* Width of the RGB MCU */
+
+#if JD_USE_RESIZE
+	/* Put the MCU into the band buffer and resize the band when an MCU row is completed */
+	if (jd->rsbuf) {
+		uint16_t sw = jd->width >> jd->scale;
+		uint8_t *s = rgb, *d;
+
+		for (iy = 0; iy < ry; iy++) {
+			d = jd->rsbuf + (iy * sw + x) * 3;
+			if (ns == 3) {
+				for (ix = 0; ix < rx * 3; ix++) *d++ = *s++;
+			} else {	/* Expand luma to RGB */
+				for (ix = 0; ix < rx; ix++) {
+					*d++ = *s; *d++ = *s; *d++ = *s++;
+				}
+			}
+			s += (mx - rx) * ns;	/* Skip truncated pixels */
+		}
+		return (x + rx >= sw) ? resize_band(jd, outfunc, y, ry) : JDR_OK;
+	}
+#endif
+
+	/* Put the MCU into the band buffer and output the MCUs put together when the batch or the MCU row is completed */
+	if (jd->bcbuf) {
+		uint16_t sw = jd->width >> jd->scale, nb, bx, bw;
+		uint8_t *s = rgb, *d, *bp, ob;
+
+		nb = (jd->width + jd->msx * 8 - 1) / (jd->msx * 8);	/* MCUs in the batch */
+		if (jd->batch < nb) nb = jd->batch;
+		bx = x / mx % nb;			/* Index of the MCU in the batch */
+		bw = nb * mx;				/* Width of the band buffer */
+		bp = jd->bcbuf;
+		ob = (Fmtbit[jd->format] + 7) / 8;	/* Wider output pixels are built in front of the source pixels */
+		if (ob > ns) bp += (uint32_t)bw * (my >> jd->scale) * (ob - ns);
+		for (iy = 0; iy < ry; iy++) {
+			d = bp + (iy * bw + bx * mx) * ns;
+			for (ix = 0; ix < rx * ns; ix++) *d++ = *s++;
+			s += (mx - rx) * ns;	/* Skip truncated pixels */
+		}
+		if (bx < nb - 1 && x + rx < sw) return JDR_OK;
+		rect.left = x - bx * mx;
+		return rect_output(jd, outfunc, bp, jd->bcbuf, &rect, bw - (rect.right - rect.left + 1), ns);
+	}
+
+	/* Write the MCU into the output buffer and tell the MCUs written when the batch or the MCU row is completed */
+	if (jd->ostride && jd->batch > 1) {
+		uint16_t sw = jd->width >> jd->scale, nb;
+		JRESULT rc;
+
+		nb = (jd->width + jd->msx * 8 - 1) / (jd->msx * 8);	/* MCUs in the batch */
+		if (jd->batch < nb) nb = jd->batch;
+		bx = x / mx % nb;			/* Index of the MCU in the batch */
+		rc = rect_output(jd, 0, rgb, 0, &rect, mx - rx, ns);
+		if (rc != JDR_OK || (bx < nb - 1 && x + rx < sw)) return rc;
+		rect.left = x - bx * mx; rect.right = x + rx - 1;
+		rect.top = y; rect.bottom = y + ry - 1;
+		if (jd->oxf) xform_rect(jd, &rect);
+		return outfunc(jd, 0, &rect) ? JDR_OK : JDR_INTR;
+	}
+
+	/* Convert the RGB or luma MCU into the output pixel format (truncated pixels are squeezed out) and output it */
+	return rect_output(jd, outfunc, rgb, jd->workbuf, &rect, mx - rx, ns);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Output the MCUs with triangle filter as the context is loaded         */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT fancy_output (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint16_t x,		/* Loaded MCU position in the image (left of the MCU) */
+	uint16_t y		/* Loaded MCU position in the image (top of the MCU) */
+)
+{
+	uint16_t mx, my, nm;
+	uint32_t i, n, ld, nd;
+	uint8_t *mcubuf, *sp, *dp;
+	JRESULT rc;
+
+
+	mx = jd->msx * 8; my = jd->msy * 8;					/* MCU size (pixel) */
+	nm = (jd->width + mx - 1) / mx;						/* Number of MCUs in an MCU row */
+	nd = (uint32_t)(jd->msy - 1) * nm + jd->msx - 1;	/* Output delay (MCUs) until the MCU at right and the MCU below are loaded */
+	ld = (uint32_t)(y / my) * nm + x / mx;				/* Index of the loaded MCU */
+	mcubuf = jd->mcubuf;
+	sp = mcubuf; dp = fancy_mcu(jd, ld);
+	for (n = jd->nblk * 64; n; n--) *dp++ = *sp++;	/* Put the loaded MCU into the ring */
+
+	i = (ld > nd) ? ld - nd : 0;						/* First MCU not output yet */
+	if (x + mx >= jd->width && y + my >= jd->height) {	/* Flush the ring at the last MCU */
+		n = ld + 1;
+	} else {
+		n = (ld >= nd) ? ld - nd + 1 : 0;
+	}
+	for (rc = JDR_OK; rc == JDR_OK && i < n; i++) {
+		fancy_context(jd, i);							/* Update the chroma context even if the MCU is not output */
+		jd->mcubuf = fancy_mcu(jd, i);
+		rc = mcu_output(jd, outfunc, (uint16_t)(i % nm * mx), (uint16_t)(i / nm * my));	/* Output the MCU in the ring */
+	}
+	jd->mcubuf = mcubuf;
+
+	return rc;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Process restart interval                                              */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT restart (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t rstn	/* Expected restert sequense number */
+)
+{
+	int d;
+
+
+	/* Discard padding bits and get the marker */
+	jd->wreg = 0; jd->dbit = 0;
+	d = jd->marker;			/* The marker may have been found by the bit extraction */
+	jd->marker = 0;
+	while (!d) {			/* Find the marker in the input stream (arithmetic-coded data may leave some bytes before it) */
+		do {
+			d = getbyte(jd);
+			if (d < 0) return JDR_INP;
+		} while (d != 0xFF);
+		do {				/* Get the marker code following the flag (0xFF can be repeated as fill bytes) */
+			d = getbyte(jd);
+			if (d < 0) return JDR_INP;
+		} while (d == 0xFF);
+	}
+
+	/* Check the marker */
+	if ((d & 0xF8) != 0xD0 || (d & 7) != (rstn & 7)) {
+		return JDR_FMT1;	/* Err: expected RSTn marker is not detected (may be collapted data) */
+	}
+
+	/* Reset DC offset */
+	jd->dcv[3] = jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+#if JD_USE_ARITH
+	if (jd->arith) arith_reset(jd);	/* Reset statistics of the arithmetic decoding */
+#endif
+
+	return JDR_OK;
+}
+
+
+
+
+#if JD_USE_PROGRESSIVE
+/*-----------------------------------------------------------------------*/
+/* Find the next marker after the entropy-coded data                     */
+/*-----------------------------------------------------------------------*/
+
+static int next_marker (	/* >=0: marker code (lower byte), <0: error code */
+	JDEC* jd		/* Pointer to the decompressor object */
+)
+{
+	int d;
+
+
+	jd->wreg = 0; jd->dbit = 0;	/* Discard padding bits */
+	if (jd->marker) {			/* The marker has been found by the bit extraction */
+		d = jd->marker;
+		jd->marker = 0;
+		if ((d & 0xF8) != 0xD0) return d;
+	}
+	do {
+		do {		/* Find a flag */
+			d = getbyte(jd);
+			if (d < 0) return d;
+		} while (d != 0xFF);
+		do {		/* Get the marker code following the flag (0xFF can be repeated as fill bytes) */
+			d = getbyte(jd);
+			if (d < 0) return d;
+		} while (d == 0xFF);
+	} while (d == 0 || (d & 0xF8) == 0xD0);	/* Skip the escaped data and RSTn markers */
+
+	return d;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load a scan header of progressive JPEG                                */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT scan_header (
+	JDEC* jd,			/* Pointer to the decompressor object */
+	const uint8_t* seg,	/* SOS segment data */
+	uint16_t len		/* Size of the segment data */
+)
+{
+	uint16_t i, c, n;
+	uint8_t b;
+
+
+	n = seg[0];									/* Number of components in the scan */
+	if (!n || n > jd->ncomp || len < 4 + 2 * n) return JDR_FMT1;	/* Err: wrong segment */
+	jd->nscomp = (uint8_t)n;
+	for (i = 0; i < n; i++) {
+		for (c = 0; c < jd->ncomp && jd->cid[c] != seg[1 + 2 * i]; c++) ;	/* Find the component */
+		if (c == jd->ncomp) return JDR_FMT1;		/* Err: unknown component */
+		b = seg[2 + 2 * i];							/* Get huffman table IDs */
+		if ((b >> 4) > 3 || (b & 15) > 3) return JDR_FMT1;	/* Err: Invalid table ID */
+		jd->scomp[i] = (uint8_t)c;
+		jd->shtid[i] = b;
+	}
+	seg += 1 + 2 * n;
+	jd->ss = seg[0]; jd->se = seg[1];			/* Spectral selection */
+	jd->ah = seg[2] >> 4; jd->al = seg[2] & 15;	/* Successive approximation */
+	if (jd->ss == 0) {							/* DC scan */
+		if (jd->se != 0) return JDR_FMT1;		/* Err: DC and AC elements in a scan */
+	} else {									/* AC scan */
+		if (jd->se < jd->ss || jd->se > 63 || n != 1) return JDR_FMT1;	/* Err: wrong band or interleaved AC scan */
+	}
+	if (jd->ah > 13 || jd->al > 13) return JDR_FMT1;
+
+#if JD_USE_ARITH
+	if (jd->arith) return arith_alloc(jd);	/* Arithmetic decoding needs statistics areas instead of huffman tables */
+#endif
+
+#if JD_USE_STDHUFF
+	default_huffman_tbl(jd);	/* Use the standard tables if not defined */
+#endif
+
+	/* Check if the huffman tables needed for the scan have been loaded */
+	for (i = 0; i < n; i++) {
+		b = jd->shtid[i];
+		if (jd->ss == 0) {
+			if (jd->ah == 0 && !jd->huffbits[b >> 4][0]) return JDR_FMT1;	/* Err: DC table not loaded */
+		} else {
+			if (!jd->huffbits[b & 15][1]) return JDR_FMT1;	/* Err: AC table not loaded */
+		}
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+#if JD_USE_ARITH
+/*-----------------------------------------------------------------------*/
+/* Load an arithmetic-coded block of progressive scan                    */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT arith_block_load (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	int16_t* blk,	/* Coefficients of the block (raster order) */
+	uint16_t sc		/* Component number in the scan */
+)
+{
+	int d;
+	uint16_t k, kex, id;
+	int16_t p1, m1, *cp;
+	uint8_t *st;
+	JRESULT rc;
+
+
+	if (jd->ss == 0) {	/* DC scan */
+		if (jd->ah == 0) {	/* First scan: get the DC difference */
+			rc = arith_dc(jd, jd->scomp[sc], jd->shtid[sc] >> 4);
+			if (rc != JDR_OK) return rc;
+			blk[0] = (int16_t)((unsigned)jd->dcv[jd->scomp[sc]] << jd->al);
+		} else {			/* Refinement scan: get a bit with fixed probability */
+			if (arith_decode(jd, &jd->arfix)) blk[0] |= (int16_t)(1 << jd->al);
+		}
+		return jd->marker == 0xFF ? JDR_INP : JDR_OK;
+	}
+
+	id = jd->shtid[sc] & 15;	/* AC scan */
+	if (jd->ah == 0) {	/* First scan of the band */
+		for (k = jd->ss; k <= jd->se; k++) {
+			rc = arith_ac(jd, id, &k, jd->se, &d);
+			if (rc != JDR_OK) return rc;
+			if (!d) break;		/* EOB? */
+			blk[ZIG(k)] = (int16_t)((unsigned)d << jd->al);
+		}
+		return jd->marker == 0xFF ? JDR_INP : JDR_OK;
+	}
+
+	/* Refinement scan of the band */
+	p1 = (int16_t)(1 << jd->al);	/* 1 in the bit position being refined */
+	m1 = -p1;						/* -1 in the bit position being refined */
+	for (kex = jd->se; kex > 0 && !blk[ZIG(kex)]; kex--) ;	/* End of block in the previous scans */
+	for (k = jd->ss; k <= jd->se; k++) {
+		st = jd->arstat[id][1] + 3 * (k - 1);
+		if (k > kex && arith_decode(jd, st)) break;	/* EOB? */
+		for (;;) {
+			cp = &blk[ZIG(k)];
+			if (*cp) {					/* Previously non-zero element: get a correction bit */
+				if (arith_decode(jd, st + 2)) *cp += *cp < 0 ? m1 : p1;
+				break;
+			}
+			if (arith_decode(jd, st + 1)) {	/* Newly non-zero element */
+				*cp = arith_decode(jd, &jd->arfix) ? m1 : p1;
+				break;
+			}
+			st += 3;
+			if (++k > jd->se) return JDR_FMT1;	/* Err: too long zero run */
+		}
+	}
+
+	return jd->marker == 0xFF ? JDR_INP : JDR_OK;
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load a block of progressive scan into the coefficient buffer          */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT block_load (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	int16_t* blk,	/* Coefficients of the block (raster order) */
+	uint16_t sc		/* Component number in the scan */
+)
+{
+	int b, d, r;
+	uint16_t k, id;
+	int16_t p1, m1, *cp;
+
+
+#if JD_USE_ARITH
+	if (jd->arith) return arith_block_load(jd, blk, sc);
+#endif
+
+	if (jd->ss == 0) {	/* DC scan */
+		if (jd->ah == 0) {	/* First scan: get the DC difference */
+			b = huffext(jd, jd->shtid[sc] >> 4, 0);
+			if (b < 0) return 0 - b;				/* Err: invalid code or input */
+			d = jd->dcv[jd->scomp[sc]];				/* DC value of previous block */
+			if (b) {
+				r = bitext(jd, b);					/* Extract data bits */
+				if (r < 0) return 0 - r;			/* Err: input */
+				b = 1 << (b - 1);					/* MSB position */
+				if (!(r & b)) r -= (b << 1) - 1;	/* Restore sign if needed */
+				d += r;
+				jd->dcv[jd->scomp[sc]] = (int16_t)d;
+			}
+			blk[0] = (int16_t)((unsigned)d << jd->al);
+		} else {			/* Refinement scan: get a bit */
+			b = bitext(jd, 1);
+			if (b < 0) return 0 - b;
+			if (b) blk[0] |= (int16_t)(1 << jd->al);
+		}
+		return JDR_OK;
+	}
+
+	id = jd->shtid[sc] & 15;	/* AC scan */
+
+	if (jd->ah == 0) {	/* First scan of the band */
+		if (jd->eobrun) {		/* In an end-of-band run? */
+			jd->eobrun--;
+			return JDR_OK;
+		}
+		for (k = jd->ss; k <= jd->se; k++) {
+			b = huffext(jd, id, 1);			/* Extract a huffman coded value (zero runs and bit length) */
+			if (b < 0) return 0 - b;		/* Err: invalid code or input error */
+			r = b >> 4;
+			if (b &= 0x0F) {				/* Non-zero element */
+				k += r;						/* Skip zero elements */
+				if (k > jd->se) return JDR_FMT1;	/* Too long zero run */
+				d = bitext(jd, b);			/* Extract data bits */
+				if (d < 0) return 0 - d;
+				b = 1 << (b - 1);			/* MSB position */
+				if (!(d & b)) d -= (b << 1) - 1;	/* Restore negative value if needed */
+				blk[ZIG(k)] = (int16_t)((unsigned)d << jd->al);
+			} else if (r == 15) {			/* ZRL: 16 zero elements */
+				k += 15;
+			} else {						/* EOBn: end of this band and following 2^n+(n bits)-1 bands */
+				jd->eobrun = (uint16_t)(1 << r);
+				if (r) {
+					d = bitext(jd, r);
+					if (d < 0) return 0 - d;
+					jd->eobrun += (uint16_t)d;
+				}
+				jd->eobrun--;
+				break;
+			}
+		}
+		return JDR_OK;
+	}
+
+	/* Refinement scan of the band */
+	p1 = (int16_t)(1 << jd->al);	/* 1 in the bit position being refined */
+	m1 = -p1;						/* -1 in the bit position being refined */
+	k = jd->ss;
+	if (!jd->eobrun) {
+		for ( ; k <= jd->se; k++) {
+			b = huffext(jd, id, 1);
+			if (b < 0) return 0 - b;
+			r = b >> 4;
+			if (b & 0x0F) {				/* A newly non-zero element (always 1-bit) */
+				d = bitext(jd, 1);
+				if (d < 0) return 0 - d;
+				d = d ? p1 : m1;
+			} else {
+				d = 0;
+				if (r != 15) {			/* EOBn (rest of the band is refined below) */
+					jd->eobrun = (uint16_t)(1 << r);
+					if (r) {
+						b = bitext(jd, r);
+						if (b < 0) return 0 - b;
+						jd->eobrun += (uint16_t)b;
+					}
+					break;
+				}
+			}
+			/* Skip r zero elements and refine the non-zero elements on the way */
+			do {
+				cp = &blk[ZIG(k)];
+				if (*cp) {
+					b = bitext(jd, 1);
+					if (b < 0) return 0 - b;
+					if (b && !(*cp & p1)) *cp += (*cp >= 0) ? p1 : m1;
+				} else {
+					if (--r < 0) break;	/* Reached the zero element to be set */
+				}
+			} while (++k <= jd->se);
+			if (d) {
+				if (k > jd->se) return JDR_FMT1;	/* Too long zero run */
+				blk[ZIG(k)] = (int16_t)d;
+			}
+		}
+	}
+	if (jd->eobrun) {	/* In an end-of-band run: refine the non-zero elements */
+		for ( ; k <= jd->se; k++) {
+			cp = &blk[ZIG(k)];
+			if (*cp) {
+				b = bitext(jd, 1);
+				if (b < 0) return 0 - b;
+				if (b && !(*cp & p1)) *cp += (*cp >= 0) ? p1 : m1;
+			}
+		}
+		jd->eobrun--;
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get the coefficient plane of a component                              */
+/*-----------------------------------------------------------------------*/
+
+static int16_t* coef_plane (	/* Pointer to the first block of the component */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t cmp,	/* Component number */
+	uint16_t* bw	/* Number of blocks in a row of the component */
+)
+{
+	uint16_t mcux, mcuy, i;
+	uint32_t ofs;
+
+
+	mcux = (jd->width + jd->msx * 8 - 1) / (jd->msx * 8);	/* Number of MCUs in the image */
+	mcuy = (jd->height + jd->msy * 8 - 1) / (jd->msy * 8);
+	*bw = mcux * jd->hs[cmp];						/* Each component has its sampling factor of blocks per MCU */
+	for (ofs = i = 0; i < cmp; i++) ofs += (uint32_t)mcux * jd->hs[i] * mcuy * jd->vs[i];	/* Blocks of the preceding components */
+
+	return jd->coef + ofs * 64;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Load a scan of progressive JPEG into the coefficient buffer           */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT scan_load (
+	JDEC* jd		/* Pointer to the decompressor object */
+)
+{
+	uint16_t x, y, w, h, u, v, hs, vs, i, cmp, rst, rsc;
+	uint32_t n;
+	uint16_t bw[4];
+	int16_t *cp[4];
+	JRESULT rc;
+
+
+	for (i = 0; i < jd->nscomp; i++) cp[i] = coef_plane(jd, jd->scomp[i], &bw[i]);
+	jd->dcv[3] = jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
+	jd->eobrun = 0;
+	jd->wreg = 0; jd->dbit = 0; jd->marker = 0;	/* Prepare to read bit stream */
+#if JD_USE_ARITH
+	if (jd->arith) arith_reset(jd);
+#endif
+	rst = rsc = 0;
+
+	if (jd->nscomp == 1) {	/* Non-interleaved scan: blocks of the component in raster order */
+		cmp = jd->scomp[0];
+		n = ((uint32_t)jd->width * jd->hs[cmp] + jd->msx - 1) / jd->msx;	/* Size of the component (pixel) */
+		w = (uint16_t)((n + 7) >> 3);			/* Size of the component (block) */
+		n = ((uint32_t)jd->height * jd->vs[cmp] + jd->msy - 1) / jd->msy;
+		h = (uint16_t)((n + 7) >> 3);
+		for (y = 0; y < h; y++) {
+			for (x = 0; x < w; x++) {
+				if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+					rc = restart(jd, rsc++);
+					if (rc != JDR_OK) return rc;
+					jd->eobrun = 0;
+					rst = 1;
+				}
+				rc = block_load(jd, cp[0] + ((uint32_t)y * bw[0] + x) * 64, 0);
+				if (rc != JDR_OK) return rc;
+			}
+		}
+	} else {				/* Interleaved scan: MCUs */
+		w = (jd->width + jd->msx * 8 - 1) / (jd->msx * 8);	/* Number of MCUs */
+		h = (jd->height + jd->msy * 8 - 1) / (jd->msy * 8);
+		for (y = 0; y < h; y++) {
+			for (x = 0; x < w; x++) {
+				if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
+					rc = restart(jd, rsc++);
+					if (rc != JDR_OK) return rc;
+					rst = 1;
+				}
+				for (i = 0; i < jd->nscomp; i++) {
+					cmp = jd->scomp[i];
+					hs = jd->hs[cmp]; vs = jd->vs[cmp];	/* Blocks of the component in the MCU */
+					for (v = 0; v < vs; v++) {
+						for (u = 0; u < hs; u++) {
+							rc = block_load(jd, cp[i] + ((uint32_t)(y * vs + v) * bw[i] + x * hs + u) * 64, i);
+							if (rc != JDR_OK) return rc;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Output the image in the coefficient buffer                            */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT scan_output (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t (*outfunc)(JDEC*, void*, JRECT*)	/* RGB output function */
+)
+{
+	int32_t *ws = (int32_t*)jd->workbuf;	/* Work area of IDCT */
+	uint32_t x, y;
+	uint16_t mx, my, u, v, cmp;
+	uint16_t bw[4];
+	int16_t *cp[4], *sp;
+	const int32_t *dqf;
+	uint8_t *bp;
+	JRESULT rc;
+
+
+	for (cmp = 0; cmp < jd->ncomp; cmp++) {
+		if (!jd->qttbl[jd->qtid[cmp]]) return JDR_FMT1;	/* Err: dequantizer table not loaded */
+		cp[cmp] = coef_plane(jd, cmp, &bw[cmp]);
+	}
+	mx = jd->msx * 8; my = jd->msy * 8;	/* Size of the MCU (pixel) */
+#if JD_USE_RESIZE
+	jd->rsy = jd->rsn = 0;				/* Restart resizing from the top */
+#endif
+
+	for (y = 0; y < jd->height; y += my) {
+		for (x = 0; x < jd->width; x += mx) {
+			/* Build an MCU from the coefficient buffer in the same form as mcu_load does */
+			bp = jd->mcubuf;
+			for (cmp = 0; cmp < jd->ncomp; cmp++) {
+				if (cmp && jd->format >= JD_FMT_GRAY8 && jd->ncomp == 3) break;	/* Chroma is not used for grayscale output */
+				dqf = jd->qttbl[jd->qtid[cmp]];
+				for (v = 0; v < jd->vs[cmp]; v++) {
+					for (u = 0; u < jd->hs[cmp]; u++, bp += 64) {
+						sp = cp[cmp] + ((uint32_t)(y / my * jd->vs[cmp] + v) * bw[cmp] + x / mx * jd->hs[cmp] + u) * 64;
+						if (JD_USE_SCALE && jd->scale == 3) {
+							*bp = (uint8_t)((sp[0] * dqf[0] >> 8) / 256 + 128);	/* Only DC element is used for 1/8 scaling */
+						} else {
+							block_idct(sp, dqf, ws, bp);	/* De-quantize, apply IDCT and store the block to the MCU buffer */
+						}
+					}
+				}
+			}
+			rc = (jd->fcbuf ? fancy_output : mcu_output)(jd, outfunc, (uint16_t)x, (uint16_t)y);	/* Output the MCU (color space conversion, scaling and output) */
+			if (rc != JDR_OK) return rc;
+		}
+	}
+
+	return JDR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decompress all scans of progressive JPEG                              */
+/*-----------------------------------------------------------------------*/
+
+static JRESULT prog_decomp (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t (*outfunc)(JDEC*, void*, JRECT*)	/* RGB output function */
+)
+{
+	uint16_t i, len;
+	uint32_t n;
+	uint8_t marker;
+	int d;
+	JRESULT rc;
 
-	if (!JD_USE_SCALE || jd->scale != 3) {	/* Not for 1/8 scaling */
 
-		/* Build an RGB MCU from discrete comopnents */
-		rgb24 = (uint8_t*)jd->workbuf;
-		for (iy = 0; iy < my; iy++) {
-			pc = jd->mcubuf;
-			py = pc + iy * 8;
-			if (my == 16) {		/* Double block height? */
-				pc += 64 * 4 + (iy >> 1) * 8;
-				if (iy >= 8) py += 64;
-			} else {			/* Single block height */
-				pc += mx * 8 + iy * 8;
-			}
-			for (ix = 0; ix < mx; ix++) {
-				cb = pc[0] - 128; 	/* Get Cb/Cr component and restore right level */
-				cr = pc[64] - 128;
-				if (mx == 16) {					/* Double block width? */
-					if (ix == 8) py += 64 - 8;	/* Jump to next block if double block heigt */
-					pc += ix & 1;				/* Increase chroma pointer every two pixels */
-				} else {						/* Single block width */
-					pc++;						/* Increase chroma pointer every pixel */
-				}
-				yy = *py++;			/* Get Y component */
+	if (!jd->coef) {	/* Allocate the coefficient buffer from the pool if not given */
+		if (SZ_OVER(jd->sz_coef)) return JDR_MEM1;
+		jd->coef = alloc_pool(jd, (jd_size_t)jd->sz_coef);
+		if (!jd->coef) return JDR_MEM1;	/* Err: not enough memory */
+	}
+	for (n = 0; n < jd->sz_coef / 2; jd->coef[n++] = 0) ;	/* Clear all coefficients */
 
-				/* Convert YCbCr to RGB */
-				*rgb24++ = /* R */ BYTECLIP(yy + ((int16_t)(1.402 * CVACC) * cr) / CVACC);
-				*rgb24++ = /* G */ BYTECLIP(yy - ((int16_t)(0.344 * CVACC) * cb + (int16_t)(0.714 * CVACC) * cr) / CVACC);
-				*rgb24++ = /* B */ BYTECLIP(yy + ((int16_t)(1.772 * CVACC) * cb) / CVACC);
-			}
+	for (;;) {
+		/* Load the scan (scans of only chroma are not needed for grayscale output) */
+		for (i = 0; i < jd->nscomp && jd->format >= JD_FMT_GRAY8 && jd->ncomp == 3 && jd->scomp[i]; i++) ;
+		if (i < jd->nscomp) {
+			rc = scan_load(jd);
+			if (rc != JDR_OK) return rc;
 		}
 
-		/* Descale the MCU rectangular if needed */
-		if (JD_USE_SCALE && jd->scale) {
-			uint16_t x, y, r, g, b, s, w, a;
-			uint8_t *op;
+		/* Process the markers up to the next scan */
+		for (;;) {
+			d = next_marker(jd);
+			if (d < 0) return 0 - d;
+			marker = (uint8_t)d;
+			if (marker == 0xD9) return scan_output(jd, outfunc);	/* EOI: output the final image */
+
+			len = 0;
+			for (i = 0; i < 2; i++) {	/* Get the length field */
+				if ((d = getbyte(jd)) < 0) return 0 - d;
+				len = (uint16_t)(len << 8 | d);
+			}
+			if (len <= 2) return JDR_FMT1;
+			len -= 2;	/* Content size excluding length field */
 
-			/* Get averaged RGB value of each square correcponds to a pixel */
-			s = jd->scale * 2;	/* Bumber of shifts for averaging */
-			w = 1 << jd->scale;	/* Width of square */
-			a = (mx - w) * 3;	/* Bytes to skip for next line in the square */
-			op = (uint8_t*)jd->workbuf;
-			for (iy = 0; iy < my; iy += w) {
-				for (ix = 0; ix < mx; ix += w) {
-					rgb24 = (uint8_t*)jd->workbuf + (iy * mx + ix) * 3;
-					r = g = b = 0;
-					for (y = 0; y < w; y++) {	/* Accumulate RGB value in the square */
-						for (x = 0; x < w; x++) {
-							r += *rgb24++;
-							g += *rgb24++;
-							b += *rgb24++;
-						}
-						rgb24 += a;
-					}							/* Put the averaged RGB value as a pixel */
-					*op++ = (uint8_t)(r >> s);
-					*op++ = (uint8_t)(g >> s);
-					*op++ = (uint8_t)(b >> s);
+			if ((marker != 0xC4 || jd->arith) && marker != 0xDB && marker != 0xDD && marker != 0xDA && (!JD_USE_ARITH || marker != 0xCC)) {
+				for (i = 0; i < len; i++) {	/* Skip segment data (comment, exif, huffman tables of arithmetic coding or etc..) */
+					if ((d = getbyte(jd)) < 0) return 0 - d;
 				}
+				continue;
 			}
-		}
-
-	} else {	/* For only 1/8 scaling (left-top pixel in each block are the DC value of the block) */
-
-		/* Build a 1/8 descaled RGB MCU from discrete comopnents */
-		rgb24 = (uint8_t*)jd->workbuf;
-		pc = jd->mcubuf + mx * my;
-		cb = pc[0] - 128;		/* Get Cb/Cr component and restore right level */
-		cr = pc[64] - 128;
-		for (iy = 0; iy < my; iy += 8) {
-			py = jd->mcubuf;
-			if (iy == 8) py += 64 * 2;
-			for (ix = 0; ix < mx; ix += 8) {
-				yy = *py;	/* Get Y component */
-				py += 64;
 
-				/* Convert YCbCr to RGB */
-				*rgb24++ = /* R */ BYTECLIP(yy + ((int16_t)(1.402 * CVACC) * cr / CVACC));
-				*rgb24++ = /* G */ BYTECLIP(yy - ((int16_t)(0.344 * CVACC) * cb + (int16_t)(0.714 * CVACC) * cr) / CVACC);
-				*rgb24++ = /* B */ BYTECLIP(yy + ((int16_t)(1.772 * CVACC) * cb / CVACC));
+			/* Load segment data */
+			if (len > JD_SZBUF) return JDR_MEM2;
+			for (i = 0; i < len; i++) {
+				if ((d = getbyte(jd)) < 0) return 0 - d;
+				jd->segbuf[i] = (uint8_t)d;
 			}
-		}
-	}
-
-	/* Squeeze up pixel table if a part of MCU is to be truncated */
-	mx >>= jd->scale;
-	if (rx < mx) {
-		uint8_t *s, *d;
-		uint16_t x, y;
 
-		s = d = (uint8_t*)jd->workbuf;
-		for (y = 0; y < ry; y++) {
-			for (x = 0; x < rx; x++) {	/* Copy effective pixels */
-				*d++ = *s++;
-				*d++ = *s++;
-				*d++ = *s++;
+			jd->ptop = 1;					/* Tables are kept over the frames of Motion-JPEG */
+			if (marker == 0xC4) {			/* DHT */
+				rc = create_huffman_tbl(jd, jd->segbuf, len);
+				if (rc) return rc;
+			} else if (marker == 0xDB) {	/* DQT */
+				rc = create_qt_tbl(jd, jd->segbuf, len);
+				if (rc) return rc;
+			} else if (marker == 0xDD) {	/* DRI */
+				if (len < 2) return JDR_FMT1;
+				jd->nrst = (uint16_t)(jd->segbuf[0] << 8 | jd->segbuf[1]);
+#if JD_USE_ARITH
+			} else if (marker == 0xCC) {	/* DAC */
+				rc = create_arith_cond(jd, jd->segbuf, len);
+				if (rc) return rc;
+#endif
+			} else {						/* SOS */
+				rc = scan_header(jd, jd->segbuf, len);
+				if (rc) return rc;
+				jd->ptop = 0;
+				if (jd->pgscan) {			/* Output the intermediate image if needed */
+					rc = scan_output(jd, outfunc);
+					if (rc) return rc;
+				}
+				break;
 			}
-			s += (mx - rx) * 3;	/* Skip truncated pixels */
+			jd->ptop = 0;
 		}
 	}
-
-	/* Convert RGB888 to RGB565 if needed */
-	if (JD_FORMAT == 1) {
-		uint8_t *s = (uint8_t*)jd->workbuf;
-		uint16_t w, *d = (uint16_t*)s;
-		uint16_t n = rx * ry;
-
-		do {
-			w = (*s++ & 0xF8) << 8;		/* RRRRR----------- */
-			w |= (*s++ & 0xFC) << 3;	/* -----GGGGGG----- */
-			w |= *s++ >> 3;				/* -----------BBBBB */
-			*d++ = w;
-		} while (--n);
-	}
-
-	/* Output the RGB rectangular */
-	return outfunc(jd, jd->workbuf, &rect) ? JDR_OK : JDR_INTR; 
 }
+#endif
 
 
 
 
+#if JD_USE_EXIF
 /*-----------------------------------------------------------------------*/
-/* Process restart interval                                              */
+/* Get orientation and locate the JPEG thumbnail in an EXIF segment      */
 /*-----------------------------------------------------------------------*/
 
-static JRESULT restart (
-	JDEC* jd,		/* Pointer to the decompressor object */
-	uint16_t rstn	/* Expected restert sequense number */
+static uint32_t exif_word (	/* Loaded value */
+	const uint8_t* p,	/* Pointer to the value */
+	uint8_t nb,			/* Size of the value (2 or 4 bytes) */
+	uint8_t le			/* Byte order (0:big endian, 1:little endian) */
 )
 {
-	uint16_t i, dc;
-	uint16_t d;
-	uint8_t *dp;
+	uint32_t d = 0;
 
 
-	/* Discard padding bits and get two bytes from the input stream */
-	dp = jd->dptr; dc = jd->dctr;
-	d = 0;
-	for (i = 0; i < 2; i++) {
-		if (!dc) {	/* No input data is available, re-fill input buffer */
-			dp = jd->inbuf;
-			dc = jd->infunc(jd, dp, JD_SZBUF);
-			if (!dc) return JDR_INP;
-		} else {
-			dp++;
-		}
-		dc--;
-		d = (d << 8) | *dp;	/* Get a byte */
+	if (le) p += nb - 1;
+	while (nb--) {
+		d = d << 8 | *p;
+		if (le) p--; else p++;
 	}
-	jd->dptr = dp; jd->dctr = dc; jd->dmsk = 0;
 
-	/* Check the marker */
-	if ((d & 0xFFD8) != 0xFFD0 || (d & 7) != (rstn & 7)) {
-		return JDR_FMT1;	/* Err: expected RSTn marker is not detected (may be collapted data) */
+	return d;
+}
+
+
+static JRESULT exif_parse (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t len,	/* Size of the APP1 segment data */
+	uint16_t* rd,	/* Number of bytes read from the segment data (out) */
+	uint16_t* tofs,	/* Offset of the thumbnail in the segment data (out, 0:not found) */
+	uint16_t* tlen	/* Size of the thumbnail (out) */
+)
+{
+	uint8_t *seg = jd->inbuf, le, i;
+	uint16_t n, tag;
+	uint32_t ifd, d, ts = 0, tn = 0;
+
+
+	*tofs = *tlen = 0; *rd = 0;
+	if (len < 14) return JDR_OK;	/* Too short for an EXIF segment */
+	if (jd->infunc(jd, seg, 14) != 14) return JDR_INP;
+	*rd = 14;
+
+	/* Check EXIF identifier and TIFF header (offsets in the EXIF data are relative to the TIFF header at seg[6]) */
+	if (seg[0] != 'E' || seg[1] != 'x' || seg[2] != 'i' || seg[3] != 'f' || seg[4] || seg[5]) return JDR_OK;
+	if (seg[6] != seg[7] || (seg[6] != 'I' && seg[6] != 'M')) return JDR_OK;
+	le = seg[6] == 'I';
+	if (exif_word(seg + 8, 2, le) != 42) return JDR_OK;
+	ifd = exif_word(seg + 10, 4, le);	/* Offset of IFD0 */
+
+	for (i = 0; i < 2; i++) {	/* Follow IFD0 (main image) to IFD1 (thumbnail) */
+		if (!ifd || ifd > len || ifd + 6 < *rd || ifd + 6 + 2 > len) return JDR_OK;	/* No IFD, or not ahead in the segment (the stream is read forward only) */
+		d = ifd + 6 - *rd;		/* Skip to the IFD */
+		if (jd->infunc(jd, 0, (jd_size_t)d) != d) return JDR_INP;
+		if (jd->infunc(jd, seg, 2) != 2) return JDR_INP;
+		*rd = (uint16_t)(ifd + 6 + 2);
+		n = (uint16_t)exif_word(seg, 2, le);	/* Number of IFD entries */
+		if ((uint32_t)*rd + n * 12 + 4 > len) return JDR_OK;
+
+		if (i == 0) {	/* IFD0: find Orientation and get offset of IFD1 */
+			for ( ; n; n--) {
+				if (jd->infunc(jd, seg, 12) != 12) return JDR_INP;
+				*rd += 12;
+				tag = (uint16_t)exif_word(seg, 2, le);
+				d = exif_word(seg + 8, 2, le);
+				if (tag == 0x0112 && d >= 1 && d <= 8) jd->orient = (uint8_t)d;
+			}
+			if (jd->infunc(jd, seg, 4) != 4) return JDR_INP;
+			*rd += 4;
+			ifd = exif_word(seg, 4, le);
+		} else {		/* IFD1: find JPEGInterchangeFormat and JPEGInterchangeFormatLength */
+			for ( ; n; n--) {
+				if (jd->infunc(jd, seg, 12) != 12) return JDR_INP;
+				*rd += 12;
+				tag = (uint16_t)exif_word(seg, 2, le);
+				if (tag == 0x0201) ts = exif_word(seg + 8, 4, le);
+				if (tag == 0x0202) tn = exif_word(seg + 8, 4, le);
+			}
+		}
 	}
 
-	/* Reset DC offset */
-	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;
+	if (tn >= 4 && ts < len && tn < len && ts + 6 >= *rd && ts + 6 + tn <= len) {	/* The thumbnail is ahead in the segment? */
+		*tofs = (uint16_t)(ts + 6);
+		*tlen = (uint16_t)tn;
+	}
 
 	return JDR_OK;
 }
+#endif
 
 
 
@@ -743,48 +3252,123 @@ static JRESULT restart (
 #define	LDB_WORD(ptr)		(uint16_t)(((uint16_t)*((uint8_t*)(ptr))<<8)|(uint16_t)*(uint8_t*)((ptr)+1))
 
 
-JRESULT jd_prepare (
-	JDEC* jd,			/* Blank decompressor object */
-	uint16_t (*infunc)(JDEC*, uint8_t*, uint16_t),	/* JPEG strem input function */
+static JRESULT prepare (
+	JDEC* jd,			/* Blank decompressor object (the session for mode 2) */
+	jd_size_t (*infunc)(JDEC*, uint8_t*, jd_size_t),	/* JPEG strem input function */
 	void* pool,			/* Working buffer for the decompression session */
-	uint16_t sz_pool,	/* Size of working buffer */
-	void* dev			/* I/O device identifier for the session */
+	jd_size_t sz_pool,	/* Size of working buffer */
+	void* dev,			/* I/O device identifier for the session */
+	uint8_t mode		/* Image to be prepared (0:main image, 1:EXIF thumbnail, 2:next frame of the session) */
 )
 {
 	uint8_t *seg, b;
 	uint16_t marker;
 	uint32_t ofs;
 	uint16_t n, i, j, len;
+	int d;
 	JRESULT rc;
+#if JD_USE_EXIF
+	uint16_t rd, tofs, tlen;
+#endif
 
 
-	if (!pool) return JDR_PAR;
-
-	jd->pool = pool;		/* Work memroy */
-	jd->sz_pool = sz_pool;	/* Size of given work memory */
-	jd->infunc = infunc;	/* Stream input function */
-	jd->device = dev;		/* I/O device identifier */
-	jd->nrst = 0;			/* No restart interval (default) */
-
-	for (i = 0; i < 2; i++) {	/* Nulls pointers */
-		for (j = 0; j < 2; j++) {
-			jd->huffbits[i][j] = 0;
-			jd->huffcode[i][j] = 0;
-			jd->huffdata[i][j] = 0;
+	if (mode == 2) {	/* Next frame of the Motion-JPEG stream (tables and settings are kept) */
+		if (!jd->inbuf || !jd->pool_frm) return JDR_PAR;	/* Err: No session */
+		jd->sz_pool += (jd_size_t)((uint8_t*)jd->pool - jd->pool_frm);	/* Release the buffers of the previous frame */
+		jd->pool = jd->pool_frm;
+		jd->segbuf = seg = alloc_pool(jd, JD_SZBUF);	/* Allocate buffer for the marker segments */
+		if (!seg) return JDR_MEM1;
+		jd->nrst = 0;			/* No restart interval (default) */
+		jd->ncomp = 0;			/* SOF0 has not been loaded */
+		jd->adobe = 0xFF;		/* No Adobe marker */
+		jd->rsbuf = 0;
+		jd->fcbuf = 0;
+		jd->coef = 0;
+		jd->sz_coef = 0;
+
+		/* Find SOI marker (rest of the previous frame and data between frames are discarded) */
+		d = jd->marker;		/* The marker may have been found in the entropy-coded data of a truncated frame */
+		jd->marker = 0;
+		while (d != 0xD8) {
+			do {		/* Find a flag */
+				d = getbyte(jd);
+				if (d < 0) return JDR_INP;
+			} while (d != 0xFF);
+			do {		/* Get the marker code following the flag */
+				d = getbyte(jd);
+				if (d < 0) return JDR_INP;
+			} while (d == 0xFF);
+		}
+		jd->ptop = 1;		/* Tables are kept over the frames */
+		ofs = 0;
+
+	} else {			/* Start of the stream */
+		if (!pool) return JDR_PAR;
+
+		jd->pool = pool;		/* Work memroy */
+		jd->sz_pool = sz_pool & ~3;	/* Size of given work memory (word aligned for the blocks taken from end of it) */
+		jd->sz_init = jd->sz_pool;
+		jd->infunc = infunc;	/* Stream input function */
+		jd->device = dev;		/* I/O device identifier */
+		jd->nrst = 0;			/* No restart interval (default) */
+		jd->ncomp = 0;			/* SOF0 has not been loaded */
+		jd->adobe = 0xFF;		/* No Adobe marker */
+		jd->orient = 1;			/* Normal orientation (default) */
+		jd->rotate = 0;			/* No display rotation (default) */
+		jd->thumb_ofs = 0;		/* No EXIF thumbnail */
+		jd->thumb_len = 0;
+
+		for (i = 0; i < 4; i++) {	/* Nulls pointers */
+			for (j = 0; j < 2; j++) {
+				jd->huffbits[i][j] = 0;
+				jd->huffcode[i][j] = 0;
+				jd->huffdata[i][j] = 0;
+#if JD_FASTDECODE
+				jd->hufflut[i][j] = 0;
+#endif
+			}
+		}
+		for (i = 0; i < 4; jd->qttbl[i++] = 0) ;
+		jd->tblro = 0;
+		jd->tblfull = 0;
+#if JD_USE_ARITH
+		for (i = 0; i < 4; i++) {
+			jd->arcond[i][0] = 0x10;	/* Default conditioning (L = 0, U = 1, Kx = 5) */
+			jd->arcond[i][1] = 5;
+			jd->arstat[i][0] = jd->arstat[i][1] = 0;
 		}
+#endif
+		jd->arith = 0;			/* Huffman coding (default) */
+		jd->rsbuf = 0;			/* Not resizing (default) */
+		jd->format = JD_FORMAT;	/* Output pixel format (default) */
+		jd->dither = 0;			/* No dithering (default) */
+		jd->fancy = 0;			/* Chroma upsampling by pixel replication (default) */
+		jd->fcbuf = 0;
+		jd->progressive = 0;	/* Baseline JPEG (default) */
+		jd->pgscan = 0;			/* No intermediate output of progressive JPEG (default) */
+		jd->batch = 0;			/* Output each MCU (default) */
+		jd->obuf = 0;			/* Pixels are passed to the output function (default) */
+		jd->ostride = 0;
+		jd->olines = 0;
+		jd->coef = 0;			/* No coefficient buffer is given (default) */
+		jd->sz_coef = 0;
+		jd->segbuf = 0;
+		jd->ptop = 0;			/* Allocate from start of the pool */
+		jd->pool_frm = 0;
+		jd->dctr = 0;			/* Input buffer is empty */
+		jd->marker = 0;
+
+		jd->inbuf = seg = alloc_pool(jd, JD_SZBUF);		/* Allocate stream input buffer */
+		if (!seg) return JDR_MEM1;
+
+		if (jd->infunc(jd, seg, 2) != 2) return JDR_INP;/* Check SOI marker */
+		if (LDB_WORD(seg) != 0xFFD8) return JDR_FMT1;	/* Err: SOI is not detected */
+		ofs = 2;
 	}
-	for (i = 0; i < 4; jd->qttbl[i++] = 0) ;
-
-	jd->inbuf = seg = alloc_pool(jd, JD_SZBUF);		/* Allocate stream input buffer */
-	if (!seg) return JDR_MEM1;
-
-	if (jd->infunc(jd, seg, 2) != 2) return JDR_INP;/* Check SOI marker */
-	if (LDB_WORD(seg) != 0xFFD8) return JDR_FMT1;	/* Err: SOI is not detected */
-	ofs = 2;
 
 	for (;;) {
 		/* Get a JPEG marker */
-		if (jd->infunc(jd, seg, 4) != 4) return JDR_INP;
+		if (seg_load(jd, seg, 4)) return JDR_INP;
 		marker = LDB_WORD(seg);		/* Marker */
 		len = LDB_WORD(seg + 2);	/* Length field */
 		if (len <= 2 || (marker >> 8) != 0xFF) return JDR_FMT1;
@@ -792,36 +3376,108 @@ JRESULT jd_prepare (
 		ofs += 4 + len;	/* Number of bytes loaded */
 
 		switch (marker & 0xFF) {
+#if JD_USE_PROGRESSIVE
+		case 0xC2:	/* SOF2 (progressive JPEG) */
+#if JD_USE_ARITH
+		case 0xCA:	/* SOF10 (progressive JPEG, arithmetic coding) */
+#endif
+#endif
+#if JD_USE_ARITH
+		case 0xC9:	/* SOF9 (extended sequential JPEG, arithmetic coding) */
+#endif
+		case 0xC1:	/* SOF1 (extended sequential JPEG, up to four huffman tables per class) */
 		case 0xC0:	/* SOF0 (baseline JPEG) */
+			if (mode == 1 && !jd->thumb_len) return JDR_FMT3;	/* Err: No thumbnail ahead of the main image */
+
 			/* Load segment data */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;
+			if (seg_load(jd, seg, len)) return JDR_INP;
+			if (seg[0] != 8) return JDR_FMT3;	/* Err: Supports only 8-bit samples */
+
+			jd->progressive = (marker & 3) == 2;	/* Progressive JPEG? */
+			jd->arith = (marker & 8) ? 1 : 0;		/* Arithmetic coding? */
 
 			jd->width = LDB_WORD(seg+3);		/* Image width in unit of pixel */
 			jd->height = LDB_WORD(seg+1);		/* Image height in unit of pixel */
-			if (seg[5] != 3) return JDR_FMT3;	/* Err: Supports only Y/Cb/Cr format */
-
-			/* Check three image components */
-			for (i = 0; i < 3; i++) {
+			jd->ncomp = seg[5];					/* Number of color components */
+			if (jd->ncomp != 3 && jd->ncomp != 1 && jd->ncomp != 4) return JDR_FMT3;	/* Err: Supports only Y/Cb/Cr, grayscale and CMYK/YCCK format */
+			if (len < 6 + 3 * jd->ncomp) return JDR_FMT1;
+
+			/* Check image components */
+			jd->msx = jd->msy = 1; jd->nblk = 0;
+			for (i = 0; i < jd->ncomp; i++) {
+				jd->cid[i] = seg[6 + 3 * i];				/* Get component identifier */
 				b = seg[7 + 3 * i];							/* Get sampling factor */
-				if (!i) {	/* Y component */
-					if (b != 0x11 && b != 0x22 && b != 0x21) {	/* Check sampling factor */
-						return JDR_FMT3;					/* Err: Supports only 4:4:4, 4:2:0 or 4:2:2 */
-					}
-					jd->msx = b >> 4; jd->msy = b & 15;		/* Size of MCU [blocks] */
-				} else {	/* Cb/Cr component */
-					if (b != 0x11) return JDR_FMT3;			/* Err: Sampling factor of Cr/Cb must be 1 */
-				}
+				if (jd->ncomp == 1) b = 0x11;				/* Single component scan is always one block per MCU */
+				jd->hs[i] = b >> 4; jd->vs[i] = b & 15;
+				if (!jd->hs[i] || jd->hs[i] > 4 || !jd->vs[i] || jd->vs[i] > 4) return JDR_FMT1;	/* Err: Invalid sampling factor */
+				if (jd->hs[i] > jd->msx) jd->msx = jd->hs[i];	/* Size of MCU [blocks] is the largest sampling factor */
+				if (jd->vs[i] > jd->msy) jd->msy = jd->vs[i];
+				jd->nblk += jd->hs[i] * jd->vs[i];
 				b = seg[8 + 3 * i];							/* Get dequantizer table ID for this component */
 				if (b > 3) return JDR_FMT3;					/* Err: Invalid ID */
 				jd->qtid[i] = b;
 			}
+			if (jd->nblk > 10) return JDR_FMT1;				/* Err: Too many blocks in the MCU */
+			for (i = 0; i < jd->ncomp; i++) {
+				if (jd->msx % jd->hs[i] || jd->msy % jd->vs[i]) return JDR_FMT3;	/* Err: Supports only integral subsampling ratio */
+			}
+			break;
+
+#if JD_USE_ARITH
+		case 0xCC:	/* DAC */
+			/* Load segment data */
+			if (len > JD_SZBUF) return JDR_MEM2;
+			if (seg_load(jd, seg, len)) return JDR_INP;
+
+			/* Load arithmetic coding conditioning tables */
+			rc = create_arith_cond(jd, seg, len);
+			if (rc) return rc;
+			break;
+#endif
+
+		case 0xEE:	/* APP14 */
+			if (len < 12 || len > JD_SZBUF) {	/* Not an Adobe marker, skip segment data */
+				if (seg_load(jd, 0, len)) return JDR_INP;
+				break;
+			}
+			if (seg_load(jd, seg, len)) return JDR_INP;
+
+			/* Get color transform of the Adobe marker */
+			if (seg[0] == 'A' && seg[1] == 'd' && seg[2] == 'o' && seg[3] == 'b' && seg[4] == 'e') jd->adobe = seg[11];
+			break;
+
+#if JD_USE_EXIF
+		case 0xE1:	/* APP1 */
+			if (mode < 2 && !jd->thumb_len) {	/* Get orientation and the thumbnail from the first EXIF segment */
+				rc = exif_parse(jd, len, &rd, &tofs, &tlen);
+				if (rc) return rc;
+				if (tofs) {
+					jd->thumb_ofs = ofs - len + tofs;	/* Offset of the thumbnail in the stream */
+					jd->thumb_len = tlen;
+				}
+				if (tofs && mode == 1) {	/* Continue with the thumbnail stream instead of the main image */
+					tofs -= rd;		/* Bytes to skip to the thumbnail */
+					if (jd->infunc(jd, 0, tofs) != (jd_size_t)tofs) return JDR_INP;
+					if (jd->infunc(jd, seg, 2) != 2) return JDR_INP;	/* Check SOI marker */
+					if (LDB_WORD(seg) != 0xFFD8) return JDR_FMT1;	/* Err: SOI is not detected */
+					ofs = jd->thumb_ofs + 2;
+					jd->nrst = 0;	/* Discard the main image parameters */
+					jd->ncomp = 0;
+					jd->adobe = 0xFF;
+					break;
+				}
+				len -= rd;
+			}
+			/* Skip rest of the segment data */
+			if (seg_load(jd, 0, len)) return JDR_INP;
 			break;
+#endif
 
 		case 0xDD:	/* DRI */
 			/* Load segment data */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;
+			if (seg_load(jd, seg, len)) return JDR_INP;
 
 			/* Get restart interval (MCUs) */
 			jd->nrst = LDB_WORD(seg);
@@ -830,7 +3486,7 @@ JRESULT jd_prepare (
 		case 0xC4:	/* DHT */
 			/* Load segment data */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;
+			if (seg_load(jd, seg, len)) return JDR_INP;
 
 			/* Create huffman tables */
 			rc = create_huffman_tbl(jd, seg, len);
@@ -840,7 +3496,7 @@ JRESULT jd_prepare (
 		case 0xDB:	/* DQT */
 			/* Load segment data */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;
+			if (seg_load(jd, seg, len)) return JDR_INP;
 
 			/* Create de-quantizer tables */
 			rc = create_qt_tbl(jd, seg, len);
@@ -850,52 +3506,97 @@ JRESULT jd_prepare (
 		case 0xDA:	/* SOS */
 			/* Load segment data */
 			if (len > JD_SZBUF) return JDR_MEM2;
-			if (jd->infunc(jd, seg, len) != len) return JDR_INP;
+			if (seg_load(jd, seg, len)) return JDR_INP;
 
 			if (!jd->width || !jd->height) return JDR_FMT1;	/* Err: Invalid image size */
 
-			if (seg[0] != 3) return JDR_FMT3;				/* Err: Supports only three color components format */
+#if JD_USE_PROGRESSIVE
+			if (jd->progressive) {
+				/* Load the scan header (dequantizer tables can be loaded later) */
+				rc = scan_header(jd, seg, len);
+				if (rc) return rc;
+			} else
+#endif
+			{
+				if (seg[0] != jd->ncomp) return JDR_FMT3;	/* Err: Supports only scans of all color components */
+#if JD_USE_STDHUFF
+				if (!jd->arith) default_huffman_tbl(jd);	/* Abbreviated streams (Motion-JPEG) may omit DHT segments */
+#endif
 
-			/* Check if all tables corresponding to each components have been loaded */
-			for (i = 0; i < 3; i++) {
-				b = seg[2 + 2 * i];	/* Get huffman table ID */
-				if (b != 0x00 && b != 0x11)	return JDR_FMT3;	/* Err: Different table number for DC/AC element */
-				b = i ? 1 : 0;
-				if (!jd->huffbits[b][0] || !jd->huffbits[b][1]) {	/* Check dc/ac huffman table for this component */
-					return JDR_FMT1;					/* Err: Nnot loaded */
+				/* Check if all tables corresponding to each components have been loaded */
+				for (i = 0; i < jd->ncomp; i++) {
+					if (seg[1 + 2 * i] != jd->cid[i]) return JDR_FMT3;	/* Err: Supports only scans in the frame order */
+					b = seg[2 + 2 * i];	/* Get huffman table IDs (DC << 4 | AC) */
+					if ((b >> 4) > 3 || (b & 15) > 3) return JDR_FMT1;	/* Err: Invalid table ID */
+					if (!jd->arith && (!jd->huffbits[b >> 4][0] || !jd->huffbits[b & 15][1])) {	/* Check dc/ac huffman table for this component */
+						return JDR_FMT1;				/* Err: Nnot loaded */
+					}
+					jd->scomp[i] = (uint8_t)i;
+					jd->shtid[i] = (uint8_t)b;
+					if (!jd->qttbl[jd->qtid[i]]) {		/* Check dequantizer table for this component */
+						return JDR_FMT1;				/* Err: Not loaded */
+					}
 				}
-				if (!jd->qttbl[jd->qtid[i]]) {			/* Check dequantizer table for this component */
-					return JDR_FMT1;					/* Err: Not loaded */
+				jd->nscomp = jd->ncomp;
+#if JD_USE_ARITH
+				if (jd->arith) {
+					rc = arith_alloc(jd);				/* Allocate statistics areas of the arithmetic decoding */
+					if (rc) return rc;
 				}
+#endif
 			}
 
 			/* Allocate working buffer for MCU and RGB */
-			n = jd->msy * jd->msx;						/* Number of Y blocks in the MCU */
-			if (!n) return JDR_FMT1;					/* Err: SOF0 has not been loaded */
-			len = n * 64 * 2 + 64;						/* Allocate buffer for IDCT and RGB output */
+			if (!jd->ncomp) return JDR_FMT1;			/* Err: SOF0 has not been loaded */
+			jd->ptop = 0;								/* Buffers from here on are released at the next frame */
+			if (mode < 2) jd->pool_frm = jd->pool;
+			n = jd->msy * jd->msx;						/* Size of the MCU in unit of block */
+			len = n * 64 * 2 + 64;						/* Allocate buffer for IDCT work area and RGB output */
+			if (jd->ncomp == 4 || jd->nblk != n + jd->ncomp - 1 || jd->hs[0] != jd->msx || jd->msx < jd->msy || jd->msx > 2) {
+				len = n * 64 * 3;						/* RGB output can occupy a part of following MCU working buffer only for 4:4:4, 4:2:2 and 4:2:0 */
+			}
 			if (len < 256) len = 256;					/* but at least 256 byte is required for IDCT */
 			jd->workbuf = alloc_pool(jd, len);			/* and it may occupy a part of following MCU working buffer for RGB output */
 			if (!jd->workbuf) return JDR_MEM1;			/* Err: not enough memory */
-			jd->mcubuf = (uint8_t*)alloc_pool(jd, (uint16_t)((n + 2) * 64));	/* Allocate MCU working buffer */
+			jd->sz_work = len;
+			jd->mcubuf = (uint8_t*)alloc_pool(jd, (uint16_t)(jd->nblk * 64 + 64));	/* Allocate MCU working buffer (coefficients of the last block take 128 bytes) */
 			if (!jd->mcubuf) return JDR_MEM1;			/* Err: not enough memory */
 
+#if JD_USE_PROGRESSIVE
+			if (jd->progressive) {
+				if (!jd->segbuf) jd->segbuf = alloc_pool(jd, JD_SZBUF);	/* Allocate buffer for the markers between scans */
+				if (!jd->segbuf) return JDR_MEM1;		/* Err: not enough memory */
+				jd->sz_coef = (uint32_t)((jd->width + jd->msx * 8 - 1) / (jd->msx * 8))	/* Size of the coefficient buffer to be given or allocated by jd_decomp */
+							* ((jd->height + jd->msy * 8 - 1) / (jd->msy * 8))
+							* jd->nblk * 64 * sizeof (int16_t);
+			}
+#endif
+
 			/* Pre-load the JPEG data to extract it from the bit stream */
-			jd->dptr = seg; jd->dctr = 0; jd->dmsk = 0;	/* Prepare to read bit stream */
-			if (ofs %= JD_SZBUF) {						/* Align read offset to JD_SZBUF */
-				jd->dctr = jd->infunc(jd, seg + ofs, (uint16_t)(JD_SZBUF - ofs));
-				jd->dptr = seg + ofs - 1;
+			jd->wreg = 0; jd->dbit = 0; jd->marker = 0;	/* Prepare to read bit stream */
+			if (mode < 2) {								/* Frames of Motion-JPEG continue in the input buffer */
+				jd->dptr = seg; jd->dctr = 0;
+				if (ofs %= JD_SZBUF) {					/* Align read offset to JD_SZBUF */
+					jd->dctr = jd->infunc(jd, seg + ofs, (jd_size_t)(JD_SZBUF - ofs));
+					jd->dptr = seg + ofs - 1;
+				}
 			}
 
 			return JDR_OK;		/* Initialization succeeded. Ready to decompress the JPEG image. */
 
-		case 0xC1:	/* SOF1 */
+#if !JD_USE_PROGRESSIVE
 		case 0xC2:	/* SOF2 */
+#endif
 		case 0xC3:	/* SOF3 */
 		case 0xC5:	/* SOF5 */
 		case 0xC6:	/* SOF6 */
 		case 0xC7:	/* SOF7 */
+#if !JD_USE_ARITH
 		case 0xC9:	/* SOF9 */
+#endif
+#if !JD_USE_ARITH || !JD_USE_PROGRESSIVE
 		case 0xCA:	/* SOF10 */
+#endif
 		case 0xCB:	/* SOF11 */
 		case 0xCD:	/* SOF13 */
 		case 0xCE:	/* SOF14 */
@@ -905,7 +3606,7 @@ JRESULT jd_prepare (
 
 		default:	/* Unknown segment (comment, exif or etc..) */
 			/* Skip segment data */
-			if (jd->infunc(jd, 0, len) != len) {	/* Null pointer specifies to skip bytes of stream */
+			if (seg_load(jd, 0, len)) {	/* Null pointer specifies to skip bytes of stream */
 				return JDR_INP;
 			}
 		}
@@ -915,6 +3616,233 @@ JRESULT jd_prepare (
 
 
 
+JRESULT jd_prepare (
+	JDEC* jd,			/* Blank decompressor object */
+	jd_size_t (*infunc)(JDEC*, uint8_t*, jd_size_t),	/* JPEG strem input function */
+	void* pool,			/* Working buffer for the decompression session */
+	jd_size_t sz_pool,	/* Size of working buffer */
+	void* dev			/* I/O device identifier for the session */
+)
+{
+#if JD_USE_CACHE
+	jd->cache = 0;
+#endif
+	return prepare(jd, infunc, pool, sz_pool, dev, 0);
+}
+
+
+
+
+#if JD_USE_CACHE
+/*-----------------------------------------------------------------------*/
+/* Initialize table cache                                                */
+/*-----------------------------------------------------------------------*/
+
+void jd_cache_init (
+	JDCACHE* cache,		/* Blank table cache */
+	void* pool,			/* Memory for the cached tables (kept while the cache is used) */
+	jd_size_t sz_pool	/* Size of the memory */
+)
+{
+	cache->pool = pool;
+	cache->sz_pool = sz_pool;
+	cache->lock = 0;
+	cache->list = 0;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Analyze the JPEG image with the table cache                           */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_prepare_cached (
+	JDEC* jd,			/* Blank decompressor object */
+	jd_size_t (*infunc)(JDEC*, uint8_t*, jd_size_t),	/* JPEG strem input function */
+	void* pool,			/* Working buffer for the decompression session */
+	jd_size_t sz_pool,	/* Size of working buffer */
+	void* dev,			/* I/O device identifier for the session */
+	JDCACHE* cache		/* Table cache shared with other sessions (the tables found are used read-only, new ones are added unless locked) */
+)
+{
+	jd->cache = cache;
+	return prepare(jd, infunc, pool, sz_pool, dev, 0);
+}
+#endif
+
+
+
+
+#if JD_USE_EXIF
+/*-----------------------------------------------------------------------*/
+/* Analyze the EXIF thumbnail and Initialize decompressor object         */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_prepare_thumb (
+	JDEC* jd,			/* Blank decompressor object */
+	jd_size_t (*infunc)(JDEC*, uint8_t*, jd_size_t),	/* JPEG strem input function (the stream of the main image) */
+	void* pool,			/* Working buffer for the decompression session */
+	jd_size_t sz_pool,	/* Size of working buffer */
+	void* dev			/* I/O device identifier for the session */
+)
+{
+#if JD_USE_CACHE
+	jd->cache = 0;
+#endif
+	return prepare(jd, infunc, pool, sz_pool, dev, 1);
+}
+#endif
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Analyze the next frame of Motion-JPEG stream                          */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_prepare_frame (
+	JDEC* jd			/* Decompressor object of the previous frame */
+)
+{
+	return prepare(jd, jd->infunc, jd->pool, jd->sz_pool, jd->device, 2);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get size of the output pixels in the output pixel format              */
+/*-----------------------------------------------------------------------*/
+
+static uint32_t out_size (	/* Size of the pixels (bytes) */
+	JDEC* jd,		/* Pointer to the decompressor object */
+	uint16_t w,		/* Width of the rectangular (pixel) */
+	uint16_t h		/* Height of the rectangular (pixel) */
+)
+{
+	return ((uint32_t)w * Fmtbit[jd->format] + 7) / 8 * h;	/* Each line starts at byte boundary */
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get memory requirement of the decompression                           */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_memreq (
+	JDEC* jd,		/* Initialized decompression object (output format, orientation and upsampling are taken into account) */
+	uint8_t scale,	/* Output de-scaling factor of jd_decomp (0 to 3, ignored when the output size is given) */
+	uint16_t dw,	/* Output size of jd_decomp_sized (0,0:the image is output by jd_decomp) */
+	uint16_t dh,
+	JDMEMREQ* mr	/* Memory requirement */
+)
+{
+	uint16_t mx, my, sw, sh, ow, oh, bh, rw, rh, i;
+	uint8_t oxf, rs;
+	uint32_t n, nb, t, a, q;
+
+
+	if (!jd->ncomp || jd->format > JD_FMT_MONO1) return JDR_PAR;
+	if (!jd->orient || jd->orient > 8 || jd->rotate > 3) return JDR_PAR;
+	oxf = out_xform(jd);
+
+	rs = 0;
+	if (dw || dh) {			/* Output size of jd_decomp_sized */
+#if JD_USE_RESIZE
+		if (oxf & 4) {
+			i = dw; dw = dh; dh = i;
+		}
+		if (!dw || !dh || dw > jd->width || dh > jd->height) return JDR_PAR;
+		for (scale = JD_USE_SCALE ? 3 : 0; scale && ((jd->width >> scale) < dw || (jd->height >> scale) < dh); scale--) ;
+		rs = ((jd->width >> scale) != dw || (jd->height >> scale) != dh);
+#else
+		return JDR_PAR;
+#endif
+	}
+	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	sw = jd->width >> scale; sh = jd->height >> scale;	/* Size of the descaled image */
+	mx = jd->msx * 8; my = jd->msy * 8;					/* Size of the MCU (pixel) */
+
+	/* Memory pool (the blocks jd_prepare has allocated and the ones jd_decomp will allocate) */
+	n = (uint32_t)(jd->sz_init - jd->sz_pool);
+	if (rs) {											/* Resizing buffers */
+		n += ((uint32_t)sw * (my >> scale) * 3 + 3) & ~3;
+		if (jd->format == JD_FMT_ARGB8888 && !jd->ostride) n += (uint32_t)dw * 4;
+		n += (uint32_t)dw * 3 * sizeof (uint32_t) + ((((uint32_t)dw + 1) * sizeof (uint16_t) + 3) & ~3);
+	}
+	if (jd->format == JD_FMT_ARGB8888 && jd->sz_work < mx * my * 4 && !jd->ostride) {	/* Larger working buffer for 32-bit output */
+		n += (uint32_t)mx * my * 4;
+	}
+	if (jd->fancy && jd->ncomp == 3 && jd->format < JD_FMT_GRAY8 && (!JD_USE_SCALE || scale != 3)	/* Chroma context for triangle filter */
+		&& jd->hs[0] == jd->msx && jd->vs[0] == jd->msy && jd->nblk == jd->msx * jd->msy + 2
+		&& jd->msx <= 2 && jd->msy <= 2 && jd->msx * jd->msy > 1) {
+		t = (jd->width + mx - 1) / mx;
+		n += (FC_ROW + t * 8 * 2 + ((jd->msy - 1) * t + jd->msx) * jd->nblk * 64 + 3) & ~3;
+	}
+	nb = 1;
+	if (jd->batch > 1 && !rs) {						/* Band buffer of the MCUs put together */
+		nb = (jd->width + mx - 1) / mx;
+		if (jd->batch < nb) nb = jd->batch;
+		i = (jd->ncomp == 1 || jd->format >= JD_FMT_GRAY8) ? 1 : 3;
+		if ((Fmtbit[jd->format] + 7) / 8 > i) i = (Fmtbit[jd->format] + 7) / 8;
+		if (!jd->ostride) n += ((nb * mx >> scale) * (my >> scale) * i + 3) & ~3;	/* not used when writing into the output buffer */
+	}
+	if (oxf && !rs) {								/* Tile buffer for the oriented output */
+		n += (nb > 1 && !jd->ostride) ? ((nb * mx >> scale) * (my >> scale) * 3 + 3) & ~3 : (uint32_t)mx * my * 3;
+	}
+
+	/* Tables defined later, at most a full size block for each (between the scans of progressive JPEG or in the next frames of Motion-JPEG) */
+	t = a = q = 0;
+	for (i = 0; i < 8; i++) {
+		if (!(jd->tblfull & 1 << i)) t += 16 + HUFF_MAX(i & 1) * 3;	/* Huffman tables */
+#if JD_FASTDECODE
+		if (!jd->hufflut[i >> 1][i & 1] || (jd->tblro & 0x10 << i)) t += (i & 1 ? 2 : 1) << HUFF_BIT;
+#endif
+#if JD_USE_ARITH
+		if (!jd->arstat[i >> 1][i & 1]) a += (i & 1) ? 256 : 64;	/* Statistics areas of arithmetic decoding */
+#endif
+	}
+	for (i = 0; i < 4; i++) {
+		if (!jd->qttbl[i] || (jd->tblro & 1 << i)) q += 64 * sizeof (int32_t);	/* Dequantizer tables */
+	}
+	mr->mjpeg = n + t + a + q;
+	if (jd->progressive) n += (jd->arith ? a : t) + q;
+	mr->pool = n;
+	mr->coef = jd->progressive ? jd->sz_coef : 0;
+
+	/* Output image, an MCU row and an MCU (before orienting) */
+	if (rs) {
+		ow = dw; oh = dh;
+		bh = my >> scale;								/* Output lines completed in an MCU row */
+		if ((uint32_t)bh * dh / sh + 1 < bh) bh = (uint16_t)((uint32_t)bh * dh / sh + 1);
+		rw = dw; rh = 1;								/* Resized image is output line by line */
+	} else {
+		ow = sw; oh = sh;
+		bh = my >> scale;
+		rw = (uint16_t)(nb * mx >> scale); rh = my >> scale;	/* MCUs put together */
+	}
+	if (bh > oh) bh = oh;
+	if (rw > ow) rw = ow;
+	if (rh > oh) rh = oh;
+	if (oxf & 4) {		/* Transposed output */
+		mr->width = oh; mr->height = ow;
+		mr->band = out_size(jd, bh, ow);
+		mr->rect = out_size(jd, rh, rw);
+	} else {
+		mr->width = ow; mr->height = oh;
+		mr->band = out_size(jd, ow, bh);
+		mr->rect = out_size(jd, rw, rh);
+	}
+	mr->frame = out_size(jd, mr->width, mr->height);
+
+	return JDR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Start to decompress the JPEG picture                                  */
 /*-----------------------------------------------------------------------*/
@@ -925,17 +3853,80 @@ JRESULT jd_decomp (
 	uint8_t scale							/* Output de-scaling factor (0 to 3) */
 )
 {
-	uint16_t x, y, mx, my;
+	uint32_t x, y, n;
+	uint16_t mx, my, i;
 	uint16_t rst, rsc;
 	JRESULT rc;
 
 
 	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	if (jd->format > JD_FMT_MONO1) return JDR_PAR;
+	if (!jd->orient || jd->orient > 8 || jd->rotate > 3) return JDR_PAR;
 	jd->scale = scale;
+	jd->oxf = out_xform(jd);
 
 	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
 
-	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
+	if (jd->ostride) {							/* Output buffer must hold the lines completed by an MCU row */
+		if (!jd->obuf) return JDR_PAR;
+		if (jd->oxf & 4) {
+			n = jd->rsbuf ? jd->dw : jd->width >> scale;
+		} else {
+			n = jd->rsbuf ? 1 : my >> scale;
+		}
+		if (jd->olines && jd->olines < n) return JDR_PAR;
+	}
+
+	if (jd->format == JD_FMT_ARGB8888 && jd->sz_work < mx * my * 4 && !jd->ostride) {	/* 32-bit output needs a larger working buffer */
+		void *wb = alloc_pool(jd, mx * my * 4);
+		if (!wb) return JDR_MEM1;				/* Err: not enough memory */
+		jd->workbuf = wb; jd->sz_work = mx * my * 4;
+	}
+
+	jd->fcbuf = 0;
+	if (jd->fancy && jd->ncomp == 3 && jd->format < JD_FMT_GRAY8 && (!JD_USE_SCALE || scale != 3)	/* Triangle filter is used for 2x upsampling of Cb/Cr blocks */
+		&& jd->hs[0] == jd->msx && jd->vs[0] == jd->msy && jd->nblk == jd->msx * jd->msy + 2
+		&& jd->msx <= 2 && jd->msy <= 2 && jd->msx * jd->msy > 1) {
+		n = (jd->width + mx - 1) / mx;			/* MCUs in an MCU row */
+		n = FC_ROW + n * 8 * 2 + ((jd->msy - 1) * n + jd->msx) * jd->nblk * 64;	/* Tiles, line, row context and ring of the MCUs */
+		if (SZ_OVER(n)) return JDR_MEM1;
+		jd->fcbuf = alloc_pool(jd, (jd_size_t)n);
+		if (!jd->fcbuf) return JDR_MEM1;		/* Err: not enough memory */
+	}
+
+	n = (uint32_t)mx * my;						/* Size of the output rectangular (pixel) */
+	jd->bcbuf = 0;
+	if (jd->batch > 1 && !jd->rsbuf && !jd->ostride) {	/* MCUs are put together in a band buffer */
+		n = (jd->width + mx - 1) / mx;			/* MCUs in an MCU row */
+		if (jd->batch < n) n = jd->batch;
+		n = (n * mx >> scale) * (my >> scale);
+		if (SZ_OVER(n * 4)) return JDR_MEM1;
+		i = (jd->ncomp == 1 || jd->format >= JD_FMT_GRAY8) ? 1 : 3;	/* Size of a source pixel (luma or RGB888) */
+		if ((Fmtbit[jd->format] + 7) / 8 > i) i = (Fmtbit[jd->format] + 7) / 8;	/* or of an output pixel if larger */
+		jd->bcbuf = alloc_pool(jd, (jd_size_t)(n * i));
+		if (!jd->bcbuf) return JDR_MEM1;		/* Err: not enough memory */
+	}
+
+	jd->otbuf = 0;
+	if (jd->oxf && !jd->rsbuf) {				/* Oriented MCUs are reordered in a tile buffer */
+		jd->otbuf = alloc_pool(jd, (jd_size_t)(n * 3));
+		if (!jd->otbuf) return JDR_MEM1;		/* Err: not enough memory */
+	}
+
+#if JD_USE_PROGRESSIVE
+	if (jd->progressive) {	/* Progressive JPEG is loaded into the coefficient buffer scan by scan */
+		int16_t *coef = jd->coef;
+
+		rc = prog_decomp(jd, outfunc);
+		jd->coef = coef;	/* Coefficient buffer allocated from the pool is not kept */
+		return rc;
+	}
+#endif
+
+	jd->dcv[3] = jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
+#if JD_USE_ARITH
+	if (jd->arith) arith_reset(jd);				/* Initialize arithmetic decoder */
+#endif
 	rst = rsc = 0;
 
 	rc = JDR_OK;
@@ -948,7 +3939,7 @@ JRESULT jd_decomp (
 			}
 			rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream and apply IDCT) */
 			if (rc != JDR_OK) return rc;
-			rc = mcu_output(jd, outfunc, x, y);	/* Output the MCU (color space conversion, scaling and output) */
+			rc = (jd->fcbuf ? fancy_output : mcu_output)(jd, outfunc, (uint16_t)x, (uint16_t)y);	/* Output the MCU (color space conversion, scaling and output) */
 			if (rc != JDR_OK) return rc;
 		}
 	}
@@ -958,3 +3949,57 @@ JRESULT jd_decomp (
 
 
 
+
+#if JD_USE_RESIZE
+/*-----------------------------------------------------------------------*/
+/* Start to decompress the JPEG picture into the given size              */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_sized (
+	JDEC* jd,								/* Initialized decompression object */
+	uint16_t (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	uint16_t dw,							/* Width of the output image (1 to width, 1 to height when orientation and rotation transpose the image) */
+	uint16_t dh								/* Height of the output image (1 to height, 1 to width when orientation and rotation transpose the image) */
+)
+{
+	uint8_t scale;
+	uint16_t sw, sh;
+	uint32_t nb, i;		/* Counter covers 3 times of the output width */
+	JRESULT rc;
+
+
+	if (!jd->orient || jd->orient > 8 || jd->rotate > 3) return JDR_PAR;
+	if (out_xform(jd) & 4) {	/* Output size is given in the oriented and rotated image */
+		i = dw; dw = dh; dh = (uint16_t)i;
+	}
+	if (!dw || !dh || dw > jd->width || dh > jd->height) return JDR_PAR;	/* Only reduction is supported */
+
+	/* Get the largest descaling ratio that does not go below the output size */
+	for (scale = JD_USE_SCALE ? 3 : 0; scale && ((jd->width >> scale) < dw || (jd->height >> scale) < dh); scale--) ;
+	sw = jd->width >> scale; sh = jd->height >> scale;
+
+	if (sw != dw || sh != dh) {	/* Resizing is needed in addition to descaling? */
+		nb = ((uint32_t)sw * (jd->msy * 8 >> scale) * 3 + 3) & ~3;	/* Band buffer for an MCU row */
+		if (jd->format == JD_FMT_ARGB8888 && !jd->ostride) nb += (uint32_t)dw * 4;	/* and a line buffer for 32-bit output */
+		if (SZ_OVER(nb) || SZ_OVER((uint32_t)dw * 12)) return JDR_MEM1;
+		jd->rsbuf = alloc_pool(jd, (jd_size_t)nb);
+		jd->rsacc = alloc_pool(jd, (jd_size_t)(dw * 3 * sizeof (uint32_t)));		/* Line accumulator */
+		jd->rsmap = alloc_pool(jd, (jd_size_t)((dw + 1) * sizeof (uint16_t)));		/* Column map */
+		if (!jd->rsbuf || !jd->rsacc || !jd->rsmap) {
+			jd->rsbuf = 0;
+			return JDR_MEM1;	/* Err: not enough memory */
+		}
+		for (i = 0; i <= dw; i++) {
+			jd->rsmap[i] = (uint16_t)(i * sw / dw);	/* Left end of the source columns of each output pixel */
+		}
+		for (i = 0; i < (uint32_t)dw * 3; jd->rsacc[i++] = 0) ;
+		jd->dw = dw; jd->dh = dh;
+		jd->rsy = jd->rsn = 0;
+	}
+
+	rc = jd_decomp(jd, outfunc, scale);
+	jd->rsbuf = 0;
+
+	return rc;
+}
+#endif
@@ -7,9 +7,17 @@
 
 /* System Configurations */
 #define	JD_SZBUF		512	/* Size of stream input buffer */
-#define JD_FORMAT		1	/* Output pixel format 0:RGB888 (3 BYTE/pix), 1:RGB565 (1 WORD/pix) */
+#define	JD_SIZE32		0	/* Size type of the memory pool and stream input (0:uint16_t, 1:size_t, allows buffers of 64K bytes or larger) */
+#define JD_FORMAT		1	/* Default output pixel format 0:RGB888 (3 BYTE/pix), 1:RGB565 (1 WORD/pix) */
 #define	JD_USE_SCALE	1	/* Use descaling feature for output */
+#define	JD_USE_RESIZE	1	/* Use resizing feature for output (jd_decomp_sized) */
+#define	JD_USE_PROGRESSIVE	1	/* Use progressive JPEG decoding feature (needs a coefficient buffer of the whole image) */
+#define	JD_USE_ARITH	1	/* Use arithmetic-coded JPEG decoding feature (SOF9, and SOF10 with JD_USE_PROGRESSIVE) */
+#define	JD_USE_EXIF		1	/* Use EXIF thumbnail locating feature (jd_prepare_thumb) */
+#define	JD_USE_CACHE	1	/* Use table cache feature to share the tables of the images from the same encoder (jd_prepare_cached) */
+#define	JD_USE_STDHUFF	1	/* Use the standard huffman tables for streams without DHT segment, e.g. Motion-JPEG (increases 1K bytes of code size, 4K bytes with JD_FASTDECODE) */
 #define JD_TBLCLIP		1	/* Use table for saturation (might be a bit faster but increases 1K bytes of code size) */
+#define JD_FASTDECODE	1	/* Use lookup tables for huffman decoding (faster but needs 512 bytes of memory pool per DC table and 1K bytes per AC table) */
 
 /*---------------------------------------------------------------------------*/
 
@@ -32,6 +40,13 @@ typedef long			int32_t;
 
 #include "stdint.h"
 
+#if JD_SIZE32
+#include "stddef.h"
+typedef size_t		jd_size_t;	/* Size of the memory pool, memory blocks and stream input */
+#else
+typedef uint16_t	jd_size_t;	/* 16-bit sizes of the original API */
+#endif
+
 /* Error code */
 typedef enum {
 	JDR_OK = 0,	/* 0: Succeeded */
@@ -47,6 +62,17 @@ typedef enum {
 
 
 
+/* Output pixel format */
+#define JD_FMT_RGB888	0	/* RGB888 (3 BYTE/pix) */
+#define JD_FMT_RGB565	1	/* RGB565 (1 WORD/pix) */
+#define JD_FMT_ARGB8888	2	/* ARGB8888 (1 DWORD/pix in native byte order, alpha is always 0xFF) */
+#define JD_FMT_RGB565_SWAP	3	/* RGB565 with bytes swapped (1 WORD/pix, LV_COLOR_16_SWAP) */
+#define JD_FMT_GRAY8	4	/* Grayscale L8 (1 BYTE/pix), formats from here on are grayscale and decode Y component only */
+#define JD_FMT_GRAY4	5	/* Grayscale L4 (2 pix/BYTE, 0 to 15 for black to white, left pixel in upper nibble, each line starts at byte boundary) */
+#define JD_FMT_MONO1	6	/* Monochrome (8 pix/BYTE, left pixel in MSB, each line starts at byte boundary) */
+
+
+
 /* Rectangular structure */
 typedef struct {
 	uint16_t left, right, top, bottom;
@@ -54,36 +80,123 @@ typedef struct {
 
 
 
+/* Table cache structure */
+typedef struct {
+	void* pool;					/* Pointer to available memory for the tables */
+	jd_size_t sz_pool;			/* Size of the memory (bytes available) */
+	uint8_t lock;				/* Tables of the decoded images are not added (0:add, 1:read-only, can be shared between threads) */
+	void* list;					/* Cached tables */
+} JDCACHE;
+
+
+
+/* Memory requirement structure */
+typedef struct {
+	uint32_t pool;				/* Size of the memory pool needed by jd_prepare and a jd_decomp (bytes, upper bound for progressive JPEG) */
+	uint32_t coef;				/* Size of the coefficient buffer of progressive JPEG (bytes, add it to the pool unless it is given prior to jd_decomp) */
+	uint32_t mjpeg;				/* Size of the memory pool keeping the session over the next frames of Motion-JPEG whatever tables they define (bytes) */
+	uint16_t width, height;		/* Size of the output image (pixel) */
+	uint32_t frame;				/* Size of the whole output image (bytes) */
+	uint32_t band;				/* Size of the output of an MCU row (bytes, buffer for streaming the output in bands) */
+	uint32_t rect;				/* Size of the largest rectangular passed to the output function (bytes) */
+} JDMEMREQ;
+
+
+
 /* Decompressor object structure */
 typedef struct JDEC JDEC;
 struct JDEC {
-	uint16_t dctr;				/* Number of bytes available in the input buffer */
+	jd_size_t dctr;				/* Number of bytes available in the input buffer */
 	uint8_t* dptr;				/* Current data read ptr */
 	uint8_t* inbuf;				/* Bit stream input buffer */
-	uint8_t dmsk;				/* Current bit in the current read byte */
+	uint32_t wreg;				/* Bit shift register of the entropy-coded data (MSB aligned) */
+	uint8_t dbit;				/* Number of bits available in the wreg */
+	uint8_t marker;				/* Marker found in the entropy-coded data (0:none) */
 	uint8_t scale;				/* Output scaling ratio */
+	uint8_t format;				/* Output pixel format (JD_FMT_*, can be changed prior to jd_decomp) */
+	uint8_t dither;				/* Ordered dithering for RGB565, L4 and monochrome formats (0:off, 1:on, can be changed prior to jd_decomp) */
+	uint8_t fancy;				/* Chroma upsampling (0:pixel replication, 1:triangle filter for 2x subsampled Cb/Cr, can be changed prior to jd_decomp) */
 	uint8_t msx, msy;			/* MCU size in unit of block (width, height) */
-	uint8_t qtid[3];			/* Quantization table ID of each component */
-	int16_t dcv[3];				/* Previous DC element of each component */
+	uint8_t hs[4], vs[4];		/* Sampling factor of each component (blocks in the MCU, width, height) */
+	uint8_t nblk;				/* Number of blocks in the MCU (1 to 10) */
+	uint8_t ncomp;				/* Number of color components 1:grayscale, 3:color, 4:CMYK/YCCK */
+	uint8_t adobe;				/* Color transform in Adobe APP14 marker (0:none (CMYK), 1:YCbCr, 2:YCCK, 0xFF:no APP14 marker, set by jd_prepare) */
+	uint8_t cid[4];				/* Component identifier of each component */
+	uint8_t qtid[4];			/* Quantization table ID of each component */
+	int16_t dcv[4];				/* Previous DC element of each component */
 	uint16_t nrst;				/* Restart inverval */
+	uint8_t progressive;		/* Progressive JPEG (0:baseline, 1:progressive, set by jd_prepare) */
+	uint8_t pgscan;				/* Output the image on every scan of progressive JPEG (0:last scan only, 1:every scan, can be changed prior to jd_decomp) */
+	uint8_t nscomp;				/* Number of components in the current scan */
+	uint8_t scomp[4];			/* Component index of each component in the current scan */
+	uint8_t shtid[4];			/* Huffman table IDs of each component in the current scan (DC << 4 | AC) */
+	uint8_t ss, se, ah, al;		/* Spectral selection and successive approximation of the current scan */
+	uint16_t eobrun;			/* Number of remaining blocks in the current end-of-band run */
+	int16_t* coef;				/* Coefficient buffer of the whole image for progressive JPEG (can be given prior to jd_decomp, allocated from the pool if NULL) */
+	uint32_t sz_coef;			/* Size of the coefficient buffer required for progressive JPEG (bytes, set by jd_prepare) */
+	uint8_t* segbuf;			/* Marker segment buffer for the markers between scans of progressive JPEG */
 	uint16_t width, height;		/* Size of the input image (pixel) */
-	uint8_t* huffbits[2][2];	/* Huffman bit distribution tables [id][dcac] */
-	uint16_t* huffcode[2][2];	/* Huffman code word tables [id][dcac] */
-	uint8_t* huffdata[2][2];	/* Huffman decoded data tables [id][dcac] */
+	uint8_t orient;				/* Orientation of the output image (EXIF Orientation 1 to 8, 1:as stored, 6:rotated 90 deg clockwise, 5 to 8 swap the output width and height, set by jd_prepare and can be changed prior to jd_decomp) */
+	uint8_t rotate;				/* Display rotation applied after the orientation (0:none, 1:90, 2:180, 3:270 deg clockwise, 1 and 3 swap the output width and height, can be changed prior to jd_decomp) */
+	uint8_t oxf;				/* Transform of the output rectangulars (bit0:mirror horizontally, bit1:mirror vertically, bit2:then transpose) */
+	uint8_t* otbuf;				/* Tile buffer for the oriented output */
+	uint16_t batch;				/* Number of MCUs put together into an output rectangular (0,1:each MCU, more than an MCU row:each MCU row, can be changed prior to jd_decomp) */
+	uint8_t* bcbuf;				/* Band buffer of the MCUs put together (NULL:each MCU is output) */
+	uint8_t* obuf;				/* Output buffer of the caller the pixels are written into (aligned to the pixel size, can be changed prior to jd_decomp) */
+	uint32_t ostride;			/* Bytes per line of the output buffer (0:pixels are passed to the output function, otherwise it is only called with NULL bitmap when the rectangular is in the output buffer, can be changed prior to jd_decomp) */
+	uint16_t olines;			/* Number of lines in the output buffer (0:whole output image, otherwise output line y is put at line y % olines, can be changed prior to jd_decomp) */
+	uint32_t thumb_ofs;			/* Offset of the JPEG thumbnail in the EXIF segment from top of the stream (bytes, 0:not found, set by jd_prepare) */
+	uint16_t thumb_len;			/* Size of the JPEG thumbnail (bytes, 0:not found, set by jd_prepare) */
+	uint16_t dw, dh;			/* Size of the output image when resizing (pixel) */
+	uint16_t rsy, rsn;			/* Current output line and number of lines accumulated into it when resizing */
+	uint8_t* rsbuf;				/* Band buffer for resizing (an MCU row in RGB888, NULL:not resizing) */
+	uint32_t* rsacc;			/* Line accumulator for resizing */
+	uint16_t* rsmap;			/* Column map for resizing (source column of each output column) */
+	uint8_t* huffbits[4][2];	/* Huffman bit distribution tables [id][dcac] */
+	uint16_t* huffcode[4][2];	/* Huffman code word tables [id][dcac] */
+	uint8_t* huffdata[4][2];	/* Huffman decoded data tables [id][dcac] */
+	uint8_t arith;				/* Arithmetic coding (0:huffman, 1:arithmetic, set by jd_prepare) */
+	uint8_t arcond[4][2];		/* Conditioning of arithmetic decoding [id][dcac] (DC: U << 4 | L, AC: Kx) */
+	uint8_t* arstat[4][2];		/* Statistics areas of arithmetic decoding [id][dcac] */
+	uint8_t arctx[4];			/* Conditioning category of the next DC difference of each component */
+	uint8_t arfix;				/* Statistics bin of the fixed probability */
+	int8_t arct;				/* Bit counter of the arithmetic decoder */
+	uint32_t arc, ara;			/* Code register and interval register of the arithmetic decoder */
+#if JD_FASTDECODE
+	void* hufflut[4][2];		/* Huffman fast decoding tables [id][dcac] (code length and decoded data indexed by the next 9 bits) */
+#endif
 	int32_t* qttbl[4];			/* Dequantizer tables [id] */
+	uint16_t tblro;				/* Shared tables not to be rebuilt in place (bit0-3:dequantizer [id], bit4-11:huffman [id][dcac]) */
+	uint8_t tblfull;			/* Huffman tables allocated in full size for the redefinitions of progressive JPEG and Motion-JPEG (bit0-7:[id][dcac]) */
+#if JD_USE_CACHE
+	JDCACHE* cache;				/* Table cache (NULL:not used) */
+#endif
 	void* workbuf;				/* Working buffer for IDCT and RGB output */
+	uint16_t sz_work;			/* Size of the working buffer */
 	uint8_t* mcubuf;			/* Working buffer for the MCU */
+	uint8_t* fcbuf;				/* Chroma context and MCUs kept for triangle filter (NULL:pixel replication) */
 	void* pool;					/* Pointer to available memory pool */
-	uint16_t sz_pool;			/* Size of momory pool (bytes available) */
-	uint16_t (*infunc)(JDEC*, uint8_t*, uint16_t);/* Pointer to jpeg stream input function */
+	jd_size_t sz_pool;			/* Size of momory pool (bytes available) */
+	jd_size_t sz_init;			/* Size of the memory pool given to jd_prepare */
+	uint8_t* pool_frm;			/* Start of the buffers released at the next frame of Motion-JPEG (set by jd_prepare) */
+	uint8_t ptop;				/* Allocate blocks from end of the pool (tables kept over the frames of Motion-JPEG) */
+	jd_size_t (*infunc)(JDEC*, uint8_t*, jd_size_t);/* Pointer to jpeg stream input function */
 	void* device;				/* Pointer to I/O device identifiler for the session */
 };
 
 
 
 /* TJpgDec API functions */
-JRESULT jd_prepare (JDEC*, uint16_t(*)(JDEC*,uint8_t*,uint16_t), void*, uint16_t, void*);
+JRESULT jd_prepare (JDEC*, jd_size_t(*)(JDEC*,uint8_t*,jd_size_t), void*, jd_size_t, void*);
+JRESULT jd_prepare_thumb (JDEC*, jd_size_t(*)(JDEC*,uint8_t*,jd_size_t), void*, jd_size_t, void*);
+JRESULT jd_prepare_frame (JDEC*);
+#if JD_USE_CACHE
+void jd_cache_init (JDCACHE*, void*, jd_size_t);
+JRESULT jd_prepare_cached (JDEC*, jd_size_t(*)(JDEC*,uint8_t*,jd_size_t), void*, jd_size_t, void*, JDCACHE*);
+#endif
+JRESULT jd_memreq (JDEC*, uint8_t, uint16_t, uint16_t, JDMEMREQ*);
 JRESULT jd_decomp (JDEC*, uint16_t(*)(JDEC*,void*,JRECT*), uint8_t);
+JRESULT jd_decomp_sized (JDEC*, uint16_t(*)(JDEC*,void*,JRECT*), uint16_t, uint16_t);
 
 
 #ifdef __cplusplus